@@ -2,6 +2,8 @@
 #define SPARK_H
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 
 /**
  * @brief A 64-bit bitboard
@@ -14,6 +16,12 @@
  */
 #define MOVE uint32_t
 
+/**
+ * @brief Compact 16-bit move representation (source, target, special code)
+ * Use ENCODE_MOVE16 and GET_MOVE16_* macros to interact.
+ */
+#define MOVE16 uint16_t
+
 /**
  * @brief Struct for storing the generator results
  */
@@ -38,6 +46,19 @@ void init_attack_tables(void);
  */
 void parse_fen(char *fen_string);
 
+/** @brief Initializes board with FEN position, rejecting bad input
+ *
+ * Like parse_fen(), but a malformed or illegal FEN (square count,
+ * kings, pawns on the back ranks, side not to move in check, an ep
+ * square no pawn can have just passed) is reported instead of
+ * ending the program. Castling rights without
+ * king and rook on their squares are dropped.
+ *
+ * @returns False if the FEN was rejected, the board is then empty
+ *
+ */
+bool load_fen(char const *fen_string);
+
 /** @brief Generates all legal moves for the current position
  *
  * @returns MoveList containing all legal moves
@@ -45,19 +66,152 @@ void parse_fen(char *fen_string);
  */
 MoveList generate_moves(void);
 
+/** @brief Generates all legal moves into a caller-owned list
+ *
+ * Same as generate_moves(), without copying the list on return.
+ * Prefer this in hot loops, e.g. with one list per ply.
+ *
+ * @param out List to fill, previous contents are discarded
+ *
+ */
+void generate_moves_into(MoveList *out);
+
+/** @brief Counts the legal moves of the current position
+ *
+ * Faster than generate_moves() when only the number of
+ * moves is needed, as no move is encoded or stored.
+ *
+ * @returns Number of legal moves
+ *
+ */
+int count_legal_moves(void);
+
+/** @brief Checks whether the side to move has any legal move
+ *
+ * Returns as soon as the first legal move is found.
+ *
+ */
+bool has_legal_move(void);
+
 /**
+ * @returns True if the side to move is checkmated
+ */
+bool is_checkmate(void);
+
+/**
+ * @returns True if the side to move is stalemated
+ */
+bool is_stalemate(void);
+
+/** @brief Enables or disables check flagging during generation
+ *
+ * When enabled, generated moves that give check have the
+ * check flag set (see GET_MOVE_CHECK). Disabled by default.
+ * Like the board, the setting is per thread.
+ *
+ */
+void set_check_flags(bool enabled);
+
+/**
+ * @returns True if the move, legal in the current position, gives check
+ */
+bool gives_check(MOVE move);
+
+/** @brief Checks a move of unknown origin (hash table, killer slot,
+ *         client) against the current position without generating
+ *         any moves
  *
- * @returns A string with the UCI move notation
+ * The piece, flags and promotion must be the ones the generator
+ * would produce, the check flag is ignored.
+ *
+ * @returns True if the move is legal apart from leaving the king in
+ *          check or castling through an attacked square
+ */
+bool is_pseudo_legal(MOVE move);
+
+/**
+ * @returns True if the move is legal in the current position and
+ *          can be passed to make_move()
+ */
+bool is_legal(MOVE move);
+
+/**
+ * @brief Maximum depth of perft()
+ */
+#define MAX_PERFT_DEPTH 64
+
+/** @brief Counts the leaves of the legal move tree below the
+ *         current position
+ *
+ * Leaves are counted from the move list of the last ply without
+ * making them. The move lists are per thread, like the board.
+ *
+ * @returns The node count, 0 if depth is outside
+ *          [0, MAX_PERFT_DEPTH]; incomplete after perft_stop()
+ */
+BB perft(int depth);
+
+/** @brief Makes running perft() calls return early, on any thread */
+void perft_stop(void);
+
+/**
+ *
+ * @returns A string with the UCI move notation,
+ *          overwritten by the next call on the same thread
  *
  */
 char *get_move_UCI(MOVE move);
 
+/** @brief Writes the UCI notation of a move
+ *
+ * @param out Buffer for the NUL-terminated result
+ * @returns Length of the notation (4, or 5 for promotions)
+ *
+ */
+int move_to_uci(MOVE move, char out[6]);
+
+/** @brief Writes a whole move list in UCI notation, space separated
+ *
+ * @param out Buffer for the NUL-terminated result
+ * @param size Size of out; moves that don't fit are left out
+ * @returns Number of characters written, without the terminator
+ *
+ */
+size_t move_list_to_uci(MoveList const *move_list, char *out, size_t size);
+
+/** @brief Parses a move in UCI notation for the current position
+ *
+ * @returns The matching legal move, or 0 if there is none
+ *
+ */
+MOVE parse_uci_move(char const *uci);
+
 /**
  * @brief Makes a move on the global board.
  *
  */
 void make_move(MOVE move);
 
+/**
+ * @returns The 16-bit form of the move
+ */
+MOVE16 compress_move(MOVE move);
+
+/**
+ * @brief Restores a 16-bit move to the 32-bit format.
+ * Must be called in the position the move belongs to.
+ *
+ * @returns The 32-bit form of the move
+ */
+MOVE expand_move(MOVE16 move);
+
+/**
+ * @brief Makes a 16-bit move on the global board.
+ * takeback() undoes it like any other move.
+ *
+ */
+void make_move16(MOVE16 move);
+
 /**
  * @brief Takes back the last move on the global board.
  *
@@ -84,6 +238,21 @@ void takeback(void);
 #define GET_MOVE_CASTLING(move)      ((move & 0x800000))
 #define GET_MOVE_CHECK(move)         ((move & 0x1000000))
 
+enum {
+  MOVE16_QUIET, MOVE16_DOUBLE, MOVE16_KING_CASTLE, MOVE16_QUEEN_CASTLE,
+  MOVE16_CAPTURE, MOVE16_EP,
+  MOVE16_PROM = 8, MOVE16_CAP_PROM = 12
+};
+
+#define ENCODE_MOVE16(source, target, code) \
+((MOVE16)((source) | ((target) << 6) | ((code) << 12)))
+
+#define GET_MOVE16_SOURCE(move)      ((move) & 0x3F)
+#define GET_MOVE16_TARGET(move)      (((move) >> 6) & 0x3F)
+#define GET_MOVE16_CODE(move)        (((move) >> 12) & 0xF)
+#define GET_MOVE16_CAPTURE(move)     ((move) & 0x4000)
+#define GET_MOVE16_PROMOTION(move)   ((move) & 0x8000)
+
 #define IS_SET(bitboard, square) bitboard & (1ULL << square)
 #define SET_BIT(bitboard, bit_nr) bitboard |= (1ULL << bit_nr)
 #define CLEAR_BIT(bitboard, bit_nr) bitboard &= ~(1ULL << bit_nr)
@@ -101,14 +270,36 @@ extern const int promoted_pieces[];
 extern const char *square_to_coordinates[];
 
 
-// Global State
-extern BB pos_pieces[12];
-extern BB pos_occupancies[3];
-extern int pos_occupancy[64];
-extern int pos_side;
-extern int pos_ep;
-extern int pos_castling;
-extern int pos_cap_piece;
+/**
+ * @brief Evaluation terms of a position, kept up to date by make_move()
+ * mg and eg (middlegame and endgame) sum material and piece-square
+ * values from white's point of view.
+ */
+typedef struct EvalState {
+  int mg;
+  int eg;
+  int phase; // 24 with all pieces on the board, more after promotions
+  int material[2]; // without kings
+  BB signature; // count of each piece P..k, 4 bits each
+} EvalState;
+
+/**
+ * @brief Number of pieces of one kind in a material signature
+ */
+#define MATERIAL_COUNT(signature, piece) (((signature) >> (4 * (piece))) & 15)
+
+// Global State, one board per thread
+extern _Thread_local BB pos_pieces[12];
+extern _Thread_local BB pos_occupancies[3];
+extern _Thread_local int pos_occupancy[64];
+extern _Thread_local int pos_side;
+extern _Thread_local int pos_ep;
+extern _Thread_local int pos_castling;
+extern _Thread_local int pos_cap_piece;
+extern _Thread_local int pos_halfmove; // plies since the last capture or pawn move
+extern _Thread_local int pos_fullmove;
+extern _Thread_local BB pos_key; // Zobrist key of the position
+extern _Thread_local EvalState pos_eval;
 
 enum {
   a8,b8,c8,d8,e8,f8,g8,h8,
@@ -179,6 +370,472 @@ BB get_king_attacks(int square);
  */
 bool is_square_attacked(int square, int side);
 
+/**
+ * @param side The attacking side
+ * @returns Bitboard of all squares attacked by the given side
+ */
+BB compute_attacks(int side);
+
+/**
+ * @param square The attacked square
+ * @param occupancy Occupancy used for sliding attacks
+ * @returns Bitboard of the pieces of both sides attacking the square
+ */
+BB attackers_to(int square, BB occupancy);
+
+/**
+ * @returns True if neither side has enough material left to mate
+ *          (no pawns, rooks or queens, and at most one minor piece
+ *          or only bishops on squares of one colour)
+ */
+bool is_insufficient_material(void);
+
+/**
+ * @returns True if the position occurred before since the last
+ *          capture or pawn move, what a search treats as a draw
+ */
+bool is_repetition(void);
+
+/**
+ * @returns True if the position occurred twice before since the
+ *          last capture or pawn move (a draw by threefold repetition)
+ *
+ * Only the moves played with make_move() are known, not the ones
+ * that led to a position set up with load_fen().
+ */
+bool is_threefold_repetition(void);
+
+/**
+ * @returns True if no capture or pawn move was made in the last
+ *          100 plies and the side to move isn't checkmated
+ */
+bool is_fifty_move_draw(void);
+
+/**
+ * @returns True if the game is drawn by threefold repetition, the
+ *          fifty-move rule or insufficient material (not stalemate)
+ */
+bool is_draw(void);
+
+/**
+ * @brief Static exchange evaluation of a move
+ *
+ * @returns Material won (in centipawns) by the side making
+ *          the move once all exchanges on the target square
+ *          have been resolved
+ */
+int see(MOVE move);
+
+/**
+ * @returns True if see(move) >= threshold, usually faster than
+ *          computing the full exchange
+ */
+bool see_ge(MOVE move, int threshold);
+
+/**
+ * @brief Maximum number of positions in a PositionBatch
+ */
+#define BATCH_CAPACITY 1024
+
+/**
+ * @brief Structure-of-arrays batch of independent positions
+ * Filled with batch_add_position(), stored from the point of
+ * view of the side to move.
+ */
+typedef struct PositionBatch {
+  BB pieces[12][BATCH_CAPACITY];
+  uint8_t castling[BATCH_CAPACITY];
+  uint8_t ep[BATCH_CAPACITY];
+  int count;
+} PositionBatch;
+
+/**
+ * @brief Empties a batch, must be called before first use
+ */
+void batch_clear(PositionBatch *batch);
+
+/**
+ * @brief Appends the current position to the batch
+ *
+ * @returns Index of the position in the batch, -1 if the batch is full
+ */
+int batch_add_position(PositionBatch *batch);
+
+/**
+ * @brief Counts the legal moves of every position in the batch
+ *
+ * Several positions are processed at once, one per SIMD lane
+ * (8 with AVX-512, 4 with AVX2, otherwise 1).
+ *
+ * @param counts Receives batch->count move counts, by index
+ */
+void count_moves_batch(PositionBatch const *batch, int *counts);
+
+/**
+ * @brief Fixed-size (32 byte) binary position record
+ *
+ * Pieces are stored as 4-bit piece codes, one per set bit of
+ * occupancy in ascending square order, lower square in the low
+ * nibble. Records are written in host byte order.
+ */
+typedef struct PackedPosition {
+  BB occupancy;
+  uint8_t pieces[16];
+  uint8_t side;
+  uint8_t castling;
+  uint8_t ep;
+  uint8_t halfmove;
+  uint16_t fullmove;
+  uint8_t reserved[2];
+} PackedPosition;
+
+/**
+ * @brief Read-only memory mapped file of PackedPosition records
+ */
+typedef struct PositionFile {
+  PackedPosition const *records;
+  size_t count;
+  size_t map_size;
+} PositionFile;
+
+/**
+ * @brief Appends PackedPosition records to a file
+ */
+typedef struct PositionWriter {
+  FILE *file;
+} PositionWriter;
+
+/** @brief Packs the current position
+ *
+ * @returns False if the position has more than 32 pieces
+ */
+bool pack_position(PackedPosition *out);
+
+/** @brief Sets up the global board from a packed record
+ *
+ * Records are checked like load_fen() input: kings, pawns on the
+ * back ranks, the ep square and the side not to move in check.
+ * Castling rights without king and rook on their squares are
+ * dropped.
+ *
+ * @returns False if the record is malformed, the board is
+ *          then left empty
+ */
+bool unpack_position(PackedPosition const *in);
+
+/** @brief Memory maps a file of packed records
+ *
+ * Records are accessed in place through file->records,
+ * file->count holds their number.
+ *
+ * @returns 0 on success, -1 on error or if the file size is
+ *          not a multiple of sizeof(PackedPosition)
+ */
+int position_file_open(PositionFile *file, char const *path);
+
+/** @brief Unmaps a file opened with position_file_open() */
+void position_file_close(PositionFile *file);
+
+/** @brief Opens a file for appending packed records
+ *
+ * @returns 0 on success, -1 on error
+ */
+int position_writer_open(PositionWriter *writer, char const *path);
+
+/** @returns 0 on success, -1 on error */
+int position_writer_add(PositionWriter *writer, PackedPosition const *record);
+
+/** @returns 0 on success, -1 on error */
+int position_writer_close(PositionWriter *writer);
+
+/**
+ * @brief Games are cut off after this many plies
+ */
+#define PLAYOUT_MAX_PLIES 900
+
+/**
+ * @brief How a playout ended
+ */
+enum {
+  PLAYOUT_CHECKMATE,
+  PLAYOUT_STALEMATE,
+  PLAYOUT_FIFTY_MOVES,
+  PLAYOUT_INSUFFICIENT_MATERIAL,
+  PLAYOUT_REPETITION,
+  PLAYOUT_PLY_LIMIT,
+  PLAYOUT_RESULTS
+};
+
+/**
+ * @brief Random number generator state (xoshiro256**), one per thread
+ */
+typedef struct PlayoutRng {
+  uint64_t s[4];
+} PlayoutRng;
+
+/**
+ * @brief Totals of run_playouts(), results is indexed by PLAYOUT_*
+ */
+typedef struct PlayoutStats {
+  uint64_t games;
+  uint64_t plies;
+  uint64_t white_wins;
+  uint64_t black_wins;
+  uint64_t results[PLAYOUT_RESULTS];
+} PlayoutStats;
+
+/** @brief Seeds a random number generator */
+void playout_seed(PlayoutRng *rng, uint64_t seed);
+
+/** @returns The next 64 random bits */
+uint64_t playout_random(PlayoutRng *rng);
+
+/** @brief Plays one game with random legal moves
+ *
+ * The game ends by checkmate, stalemate, the fifty-move rule,
+ * insufficient material, threefold repetition or after
+ * PLAYOUT_MAX_PLIES plies. The final position is left on the board.
+ *
+ * @param weighted Favour captures, queen promotions and checks
+ *        (checks are only seen with set_check_flags(true))
+ * @param out Receives every position of the game, may be NULL
+ * @returns The PLAYOUT_* result, -1 if the FEN is rejected (see
+ *          load_fen())
+ */
+int play_random_game(char const *fen, PlayoutRng *rng, bool weighted, PositionWriter *out);
+
+/** @brief Plays a number of random games
+ *
+ * Start positions are used in turn. Check flags are enabled
+ * for weighted games and disabled afterwards.
+ *
+ * @param out Receives every position of every game, may be NULL
+ * @returns False if a start position is rejected, stats then
+ *          count the games played before it
+ */
+bool run_playouts(char *const *fens, int fen_count, uint64_t games, uint64_t seed,
+                  bool weighted, PositionWriter *out, PlayoutStats *stats);
+
+/**
+ * @brief Writes the FEN of the current position
+ *
+ * @param out Buffer for the NUL-terminated FEN, 100 bytes always suffice
+ * @returns The length of the FEN, as snprintf()
+ */
+int board_to_fen(char *out, size_t size);
+
+/**
+ * @brief Copy of a thread's board, including its move history
+ */
+typedef struct BoardSnapshot {
+  BB pieces[12];
+  BB occupancies[3];
+  int occupancy[64];
+  int side;
+  int ep;
+  int castling;
+  int cap_piece;
+  int halfmove;
+  int fullmove;
+  BB key;
+  EvalState eval;
+  struct { int items[1000]; int index; } moves, irrev_aspects;
+  BB key_history[1000];
+  EvalState eval_history[1000];
+} BoardSnapshot;
+
+/** @brief Copies the board of the calling thread
+ *
+ * Together with board_restore(), hands a position (moves played
+ * included) over to another thread.
+ */
+void board_snapshot(BoardSnapshot *out);
+
+/** @brief Sets up the calling thread's board from a snapshot */
+void board_restore(BoardSnapshot const *in);
+
+/**
+ * @brief Zobrist key of the current position computed from scratch
+ * pos_key holds the same value, maintained incrementally.
+ */
+BB compute_key(void);
+
+/**
+ * @brief Computes the evaluation terms of the current position from scratch
+ * pos_eval holds the same values, maintained incrementally.
+ */
+void compute_eval_state(EvalState *out);
+
+/**
+ * @returns Static evaluation of the current position in centipawns,
+ *          from the point of view of the side to move, read from
+ *          pos_eval without scanning the board
+ */
+int evaluate(void);
+
+#define SEARCH_MAX_PLY 64
+#define SEARCH_INFINITY 32000
+
+/**
+ * @brief Score of being mated now; mate in n plies scores SEARCH_MATE - n
+ */
+#define SEARCH_MATE 31000
+
+/**
+ * @brief Result of the last completed iteration of search()
+ */
+typedef struct SearchResult {
+  MOVE best_move;
+  int score;
+  int depth;
+  uint64_t nodes;
+  int64_t time_ms;
+  MOVE pv[SEARCH_MAX_PLY];
+  int pv_length;
+} SearchResult;
+
+/**
+ * @brief Limits of search(), zero means no limit
+ */
+typedef struct SearchLimits {
+  int depth;
+  uint64_t nodes;
+  int64_t time_ms;
+  void (*report)(SearchResult const *result); // called after every iteration, may be NULL
+} SearchLimits;
+
+/** @brief Searches the current position by iterative deepening
+ *
+ * Alpha-beta (principal variation search) with a transposition
+ * table, quiescence search, killer and history move ordering and
+ * null move pruning, on search_set_threads() threads. The calling
+ * thread's board is left unchanged.
+ *
+ * @param result Receives the best move, score, principal variation
+ *        and statistics of the deepest completed iteration
+ * @returns The best move, 0 if there is no legal move
+ */
+MOVE search(SearchLimits const *limits, SearchResult *result);
+
+/** @brief Loads NNUE weights for evaluate()
+ *
+ * The network has HalfKA inputs (own king square, piece, square)
+ * into 2 x 256 accumulators, kept up to date by make_move(), then
+ * clipped ReLU layers of 32 and 1 neurons. The file format is
+ * described in src/nnue/nnue.c. Must not be called during a search.
+ *
+ * @returns 0 on success, -1 if the file can't be read or has
+ *          other dimensions
+ */
+int nnue_load(char const *path);
+
+/** @brief Switches evaluate() between the network and the built-in
+ *         material and piece-square evaluation (the default)
+ *
+ * Threads other than the caller have to set up their position
+ * again afterwards.
+ *
+ * @returns Whether the network is used, it has to be loaded first
+ */
+bool nnue_enable(bool enabled);
+
+/**
+ * @returns The network's evaluation in centipawns from the point of
+ *          view of the side to move, requires nnue_load()
+ */
+int nnue_evaluate(void);
+
+/** @brief Makes a running search() return as soon as possible */
+void search_stop(void);
+
+/** @brief Clears the transposition table, killers and history */
+void search_clear(void);
+
+/** @brief Sets the number of search threads (1 by default)
+ *
+ * Helper threads (Lazy SMP) search the same root on their own
+ * copies of the board and share the transposition table. Must not
+ * be called during a search.
+ *
+ * @returns 0 on success, -1 if count is not within 1 to 256
+ */
+int search_set_threads(int count);
+
+/** @brief Resizes the transposition table (16 MB by default)
+ *
+ * @returns 0 on success, -1 if the memory can't be allocated
+ */
+int search_set_hash(int megabytes);
+
+/**
+ * @brief Number of random keys a Polyglot key is made of
+ */
+#define POLYGLOT_KEY_COUNT 781
+
+/**
+ * @brief Size of an entry of a Polyglot book
+ */
+#define POLYGLOT_ENTRY_SIZE 16
+
+/**
+ * @brief Read-only memory mapped Polyglot opening book
+ */
+typedef struct PolyglotBook {
+  uint8_t const *entries;
+  size_t count;
+  size_t map_size;
+} PolyglotBook;
+
+/**
+ * @brief A book move of the current position and its weight
+ */
+typedef struct BookMove {
+  MOVE move;
+  uint16_t weight;
+} BookMove;
+
+/** @brief Replaces the keys used by polyglot_key()
+ *
+ * A book only matches the key table it was written with. The
+ * built-in table is the standard Random64 one (starting position
+ * 0x463B96181691FC9C), only books written with other keys need
+ * their table set here. Must not be called while probing.
+ */
+void polyglot_set_keys(BB const keys[POLYGLOT_KEY_COUNT]);
+
+/**
+ * @returns The Polyglot key of the current position
+ */
+BB polyglot_key(void);
+
+/** @brief Maps a Polyglot .bin book read-only
+ *
+ * @returns 0 on success, -1 on error or if the file size is
+ *          not a multiple of POLYGLOT_ENTRY_SIZE
+ */
+int polyglot_open(PolyglotBook *book, char const *path);
+
+/** @brief Unmaps a book opened with polyglot_open() */
+void polyglot_close(PolyglotBook *book);
+
+/** @brief Looks up the current position in a book
+ *
+ * Binary search over the mapped entries. Moves that aren't legal
+ * in the position are left out.
+ *
+ * @param out Receives up to max moves, ready for make_move()
+ * @returns The number of moves found
+ */
+int polyglot_probe(PolyglotBook const *book, BookMove *out, int max);
+
+/** @brief Chooses a book move of the current position
+ *
+ * @param random A random number, moves are chosen with a
+ *        probability proportional to their weight
+ * @returns The move, 0 if there is none with a weight above 0
+ */
+MOVE polyglot_pick(PolyglotBook const *book, uint64_t random);
+
 /**
  * @param fen_string A chess position in FEN notation 
  * Sets up a board position on the global board
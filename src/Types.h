@@ -13,4 +13,10 @@
  */
 #define MOVE uint32_t
 
+/**
+ * @brief Compact 16-bit move representation
+ * Use ENCODE_MOVE16 and GET_MOVE16_* macros to interact.
+ */
+#define MOVE16 uint16_t
+
 #endif //TYPES_H
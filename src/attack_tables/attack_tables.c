@@ -1,5 +1,7 @@
 #include "../board/board.h"
 #include "attack_tables.h"
+#include "../zobrist/zobrist.h"
+#include "../eval/eval.h"
 
 static BB init_king_attacks(int square);
 static BB init_knight_attacks(int square);
@@ -9,6 +11,7 @@ static BB get_rook_attacks_with_blockers(int square, BB blocker);
 static BB get_bishop_attacks_with_blockers(int square, BB blocker);
 static BB get_rook_attack_mask(int square);
 static BB get_bishop_attack_mask(int square);
+static void init_line_tables(void);
 
 BB pawn_attacks[2][64];
 BB knight_attacks[64];
@@ -16,6 +19,8 @@ BB king_attacks[64];
 BB bishop_attacks[64][512];
 BB rook_attacks[64][4096];
 BB queen_attacks[64];
+BB between_squares[64][64];
+BB line_squares[64][64];
 
 BB rook_masks[64];
 BB bishop_masks[64];
@@ -110,6 +115,14 @@ BB get_queen_attacks(int const square, BB const total_occupancy) {
     return get_bishop_attacks(square, total_occupancy) | get_rook_attacks(square, total_occupancy);
 }
 
+BB get_between(int const square1, int const square2) {
+    return between_squares[square1][square2];
+}
+
+BB get_line(int const square1, int const square2) {
+    return line_squares[square1][square2];
+}
+
 
 void init_attack_tables(void) {
     int occupancy_indexes;
@@ -153,6 +166,41 @@ void init_attack_tables(void) {
 
     }
 
+    init_line_tables();
+    init_zobrist();
+    init_eval();
+}
+
+/*
+Fills between_squares and line_squares for every pair of squares
+sharing a rank, file or diagonal. Relies on the slider tables,
+so it has to run after they have been initialized.
+*/
+static void init_line_tables(void) {
+    for (int square1 = 0; square1 < 64; square1++) {
+        BB const bishop_empty = get_bishop_attacks(square1, 0ULL);
+        BB const rook_empty = get_rook_attacks(square1, 0ULL);
+
+        for (int square2 = 0; square2 < 64; square2++) {
+            BB const bb1 = 1ULL << square1;
+            BB const bb2 = 1ULL << square2;
+
+            if (bishop_empty & bb2) {
+                between_squares[square1][square2] =
+                    get_bishop_attacks(square1, bb2) & get_bishop_attacks(square2, bb1);
+                line_squares[square1][square2] =
+                    (bishop_empty & get_bishop_attacks(square2, 0ULL)) | bb1 | bb2;
+            } else if (rook_empty & bb2) {
+                between_squares[square1][square2] =
+                    get_rook_attacks(square1, bb2) & get_rook_attacks(square2, bb1);
+                line_squares[square1][square2] =
+                    (rook_empty & get_rook_attacks(square2, 0ULL)) | bb1 | bb2;
+            } else {
+                between_squares[square1][square2] = 0ULL;
+                line_squares[square1][square2] = 0ULL;
+            }
+        }
+    }
 }
 
 BB init_pawn_attacks(int const square, int const side) {
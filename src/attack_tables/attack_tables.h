@@ -47,4 +47,22 @@ BB get_queen_attacks(int square, BB total_occupancy);
  */
 BB get_king_attacks(int square);
 
+/**
+ * @param square1 first square
+ * @param square2 second square
+ *
+ * @returns Bitboard of the squares strictly between the two squares
+ *          if they share a rank, file or diagonal, otherwise empty
+ */
+BB get_between(int square1, int square2);
+
+/**
+ * @param square1 first square
+ * @param square2 second square
+ *
+ * @returns Bitboard of the full rank, file or diagonal through both
+ *          squares (edge to edge), otherwise empty
+ */
+BB get_line(int square1, int square2);
+
 #endif
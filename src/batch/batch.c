@@ -0,0 +1,219 @@
+#include <string.h>
+#include "../attack_tables/attack_tables.h"
+#include "../board/board.h"
+#include "batch.h"
+
+/*
+ * Legal move counting over many positions at once. Every vector lane
+ * holds one position of the batch, and all target masks (pawns,
+ * knights, kings and sliders) are computed setwise with shifts and
+ * Kogge-Stone fills, so no lane ever needs a table lookup. The kernel
+ * is written with GCC vector extensions and compiles to AVX-512 (8
+ * lanes), AVX2 (4 lanes) or plain 64-bit code (1 lane) depending on
+ * the target. Only en passant is resolved per position.
+ */
+
+#if defined(__AVX512F__)
+#define LANES 8
+#elif defined(__AVX2__)
+#define LANES 4
+#else
+#define LANES 1
+#endif
+
+typedef BB VBB __attribute__((vector_size(LANES * sizeof(BB))));
+
+// all ones in the lanes where x is (non) zero
+#define NONZERO(x) ((VBB)((x) != 0))
+#define ZERO(x) ((VBB)((x) == 0))
+
+// ray directions as square offsets, with the mask that removes the
+// squares wrapped around the board edge by a shift in that direction.
+// Directions 2i and 2i+1 are opposite and form line i.
+static const int dir_shift[8] = {-8, 8, -1, 1, -9, 9, -7, 7};
+static const BB dir_mask[8] = {~0ULL, ~0ULL, NOT_H, NOT_A, NOT_H, NOT_A, NOT_A, NOT_H};
+
+static const int knight_shift[8] = {-17, -15, -10, -6, 6, 10, 15, 17};
+static const BB knight_mask[8] = {NOT_H, NOT_A, NOT_GH, NOT_AB, NOT_GH, NOT_AB, NOT_H, NOT_A};
+
+static inline VBB shift(VBB bb, int offset);
+static inline VBB ray(VBB gen, VBB empty, int dir);
+static inline VBB popcount(VBB bb);
+static void count_block(PositionBatch const *batch, int first, int *counts);
+static int count_ep(PositionBatch const *batch, int index);
+
+static inline VBB shift(VBB const bb, int const offset) {
+  return offset > 0 ? bb << offset : bb >> -offset;
+}
+
+/*
+ * Squares attacked by the sliders in gen in direction dir, up to and
+ * including the first occupied square.
+ */
+static inline VBB ray(VBB gen, VBB const empty, int const dir) {
+  int const s = dir_shift[dir];
+  VBB pro = empty & dir_mask[dir];
+
+  gen |= pro & shift(gen, s);
+  pro &= shift(pro, s);
+  gen |= pro & shift(gen, 2 * s);
+  pro &= shift(pro, 2 * s);
+  gen |= pro & shift(gen, 4 * s);
+  return shift(gen, s) & dir_mask[dir];
+}
+
+static inline VBB popcount(VBB const bb) {
+  VBB count;
+  for (int i = 0; i < LANES; i++)
+    count[i] = POPCNT(bb[i]);
+  return count;
+}
+
+void batch_clear(PositionBatch *const batch) {
+  memset(batch->pieces, 0, sizeof(batch->pieces));
+  memset(batch->castling, 0, sizeof(batch->castling));
+  memset(batch->ep, none, sizeof(batch->ep));
+  batch->count = 0;
+}
+
+/*
+ * Appends the position of the global board to the batch.
+ * Black-to-move positions are mirrored (a bswap flips the ranks)
+ * with the colours swapped, which keeps the move count unchanged.
+ */
+int batch_add_position(PositionBatch *const batch) {
+  if (batch->count == BATCH_CAPACITY)
+    return -1;
+
+  int const index = batch->count++;
+
+  if (pos_side == WHITE) {
+    for (int piece = P; piece <= k; piece++)
+      batch->pieces[piece][index] = pos_pieces[piece];
+    batch->castling[index] = pos_castling;
+    batch->ep[index] = pos_ep;
+  } else {
+    for (int piece = P; piece <= K; piece++) {
+      batch->pieces[piece][index] = __builtin_bswap64(pos_pieces[piece + p]);
+      batch->pieces[piece + p][index] = __builtin_bswap64(pos_pieces[piece]);
+    }
+    batch->castling[index] = (pos_castling >> 2) | ((pos_castling & (wk | wq)) << 2);
+    batch->ep[index] = pos_ep == none ? none : pos_ep ^ 56;
+  }
+  return index;
+}
+
+void count_moves_batch(PositionBatch const *const batch, int *const counts) {
+  for (int first = 0; first < batch->count; first += LANES)
+    count_block(batch, first, counts);
+}
+
+/*
+ * Counts the legal moves of LANES consecutive positions, white to move.
+ */
+static void count_block(PositionBatch const *const batch, int const first, int *const counts) {
+  VBB pc[12];
+  for (int piece = P; piece <= k; piece++)
+    memcpy(&pc[piece], &batch->pieces[piece][first], sizeof(VBB));
+
+  VBB rights;
+  for (int i = 0; i < LANES; i++)
+    rights[i] = batch->castling[first + i];
+
+  VBB const king = pc[K];
+  VBB const ours = pc[P] | pc[N] | pc[B] | pc[R] | pc[Q] | king;
+  VBB const theirs = pc[p] | pc[n] | pc[b] | pc[r] | pc[q] | pc[k];
+  VBB const empty = ~(ours | theirs);
+  VBB const their_orth = pc[r] | pc[q];
+  VBB const their_diag = pc[b] | pc[q];
+
+  // squares attacked by the opponent, seen through our king
+  VBB danger = ((pc[p] << 7) & NOT_H) | ((pc[p] << 9) & NOT_A);
+  for (int i = 0; i < 8; i++) {
+    danger |= shift(pc[n], knight_shift[i]) & knight_mask[i];
+    danger |= shift(pc[k], dir_shift[i]) & dir_mask[i];
+    danger |= ray(i < 4 ? their_orth : their_diag, empty | king, i);
+  }
+
+  // checkers, squares that resolve a slider check and pins, per line
+  VBB checkers = (((king >> 9) & NOT_H) | ((king >> 7) & NOT_A)) & pc[p];
+  VBB block = {0};
+  VBB pin_lines[4] = {{0}};
+  for (int i = 0; i < 8; i++) {
+    VBB const sliders = i < 4 ? their_orth : their_diag;
+    VBB const from_king = ray(king, empty, i);
+    VBB const checker = from_king & sliders;
+
+    checkers |= (shift(king, knight_shift[i]) & knight_mask[i] & pc[n]) | checker;
+    block |= from_king & NONZERO(checker);
+    pin_lines[i / 2] |= from_king & ray(sliders, empty, i ^ 1) & ours;
+  }
+  VBB const pinned = pin_lines[0] | pin_lines[1] | pin_lines[2] | pin_lines[3];
+
+  // no check: any square not ours; single check: capture or block; double check: none
+  VBB const target = (~ours & ZERO(checkers)) |
+                     ((block | checkers) & NONZERO(checkers) & ZERO(checkers & (checkers - 1)));
+
+  VBB king_moves = {0};
+  for (int i = 0; i < 8; i++)
+    king_moves |= shift(king, dir_shift[i]) & dir_mask[i];
+  VBB total = popcount(king_moves & ~ours & ~danger);
+
+  // comparison lanes are -1 when true
+  total -= NONZERO(rights & wk) & ZERO(~empty & F1G1) & ZERO(danger & E1F1G1);
+  total -= NONZERO(rights & wq) & ZERO(~empty & D1C1B1) & ZERO(danger & E1D1C1);
+
+  // pinned knights never move; pinned sliders move along their pin line only
+  VBB const knights = pc[N] & ~pinned;
+  for (int i = 0; i < 8; i++) {
+    VBB const movers = (i < 4 ? pc[R] : pc[B]) | pc[Q];
+    total += popcount(shift(knights, knight_shift[i]) & knight_mask[i] & target);
+    total += popcount(ray(movers & (~pinned | pin_lines[i / 2]), empty, i) & target);
+  }
+
+  VBB single = ((pc[P] & (~pinned | pin_lines[0])) >> 8) & empty;
+  VBB const double_push = ((single & RANK_3) >> 8) & empty & target;
+  single &= target;
+  VBB const west = ((pc[P] & (~pinned | pin_lines[2])) >> 9) & NOT_H & theirs & target;
+  VBB const east = ((pc[P] & (~pinned | pin_lines[3])) >> 7) & NOT_A & theirs & target;
+  total += popcount(single) + popcount(double_push) + popcount(west) + popcount(east)
+    + 3 * (popcount(single & RANK_8) + popcount(west & RANK_8) + popcount(east & RANK_8));
+
+  for (int i = 0; i < LANES && first + i < batch->count; i++)
+    counts[first + i] = (int) total[i] + count_ep(batch, first + i);
+}
+
+/*
+ * En passant removes two pawns from one rank, so each capture is
+ * verified by recomputing the attacks on the king.
+ */
+static int count_ep(PositionBatch const *const batch, int const index) {
+  int const ep = batch->ep[index];
+  if (ep == none)
+    return 0;
+
+  BB pc[12];
+  for (int piece = P; piece <= k; piece++)
+    pc[piece] = batch->pieces[piece][index];
+
+  int const king_sq = FIRST_SET_BIT(pc[K]);
+  BB const captured = 1ULL << (ep + 8);
+  BB occupancy = 0;
+  for (int piece = P; piece <= k; piece++)
+    occupancy |= pc[piece];
+
+  int count = 0;
+  BB sources = get_pawn_attacks(ep, BLACK) & pc[P];
+  while (sources) {
+    int const source = FIRST_SET_BIT(sources);
+    BB const occ = (occupancy ^ (1ULL << source) ^ captured) | (1ULL << ep);
+
+    if (!(get_bishop_attacks(king_sq, occ) & (pc[b] | pc[q])) &&
+        !(get_rook_attacks(king_sq, occ) & (pc[r] | pc[q])) &&
+        !(get_knight_attacks(king_sq) & pc[n]) &&
+        !(get_pawn_attacks(king_sq, WHITE) & pc[p] & ~captured))
+      count++;
+    CLEAR_BIT(sources, source);
+  }
+  return count;
+}
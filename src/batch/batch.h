@@ -0,0 +1,25 @@
+#ifndef SPARK_BATCH_H
+#define SPARK_BATCH_H
+#include <stdint.h>
+#include "../Types.h"
+
+#define BATCH_CAPACITY 1024
+
+/*
+ * Structure-of-arrays batch of independent positions. Positions are
+ * stored from the point of view of the side to move: black-to-move
+ * positions are mirrored vertically with colours swapped, so that the
+ * counting kernel only ever deals with white to move.
+ */
+typedef struct PositionBatch {
+  BB pieces[12][BATCH_CAPACITY];
+  uint8_t castling[BATCH_CAPACITY];
+  uint8_t ep[BATCH_CAPACITY];
+  int count;
+} PositionBatch;
+
+void batch_clear(PositionBatch *batch);
+int batch_add_position(PositionBatch *batch);
+void count_moves_batch(PositionBatch const *batch, int *counts);
+
+#endif
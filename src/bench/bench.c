@@ -0,0 +1,68 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../../inc/spark.h"
+
+/*
+ * Search benchmark: searches a fixed set of positions to a fixed
+ * depth from an empty transposition table and reports the total
+ * node count and speed. The node count is deterministic, so it also
+ * tells whether a change altered the search.
+ *
+ * Usage: bench [depth] [threads]
+ */
+
+#define DEFAULT_DEPTH 7
+
+static char *bench_positions[] = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+  "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+  "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+  "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+  "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+  "r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq - 4 4",
+  "6k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 0 1",
+  "8/8/4k3/8/2p5/8/B2P2K1/8 w - - 0 1",
+  "r1b1k2r/ppppnppp/2n2q2/2b5/3NP3/2P1B3/PP3PPP/RN1QKB1R w KQkq - 0 1",
+};
+
+static int64_t elapsed_ms(struct timespec const *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t) (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+int main(int argc, char *argv[]) {
+  int const depth = argc > 1 ? atoi(argv[1]) : DEFAULT_DEPTH;
+  int const threads = argc > 2 ? atoi(argv[2]) : 1;
+  int const count = sizeof(bench_positions) / sizeof(bench_positions[0]);
+  SearchLimits const limits = {.depth = depth};
+  SearchResult result;
+  uint64_t total = 0;
+  struct timespec start;
+
+  if (depth < 1 || search_set_threads(threads) < 0) {
+    fprintf(stderr, "Usage: %s [depth] [threads]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  init_attack_tables();
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (int i = 0; i < count; i++) {
+    parse_fen(bench_positions[i]);
+    search_clear();
+    search(&limits, &result);
+    printf("position %2d: bestmove %s score %6d nodes %10lu\n", i + 1, get_move_UCI(result.best_move), result.score,
+           result.nodes);
+    total += result.nodes;
+  }
+
+  int64_t const ms = elapsed_ms(&start);
+  printf("\nNodes: %lu\n", total);
+  printf("Time taken: %ld ms\n", ms);
+  printf("Nodes/second: %lu\n", ms ? total * 1000 / ms : total);
+  return EXIT_SUCCESS;
+}
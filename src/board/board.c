@@ -1,7 +1,11 @@
 #include <stdio.h>
 #include <limits.h>
+#include <string.h>
 #include "board.h"
 #include "../move_encoding/move_encoding.h"
+#include "../zobrist/zobrist.h"
+#include "../eval/eval.h"
+#include "../nnue/nnue.h"
 
 
 static void push(int_stack *is, int item);
@@ -10,30 +14,38 @@ static int pop(int_stack *is);
 static void save_state(void);
 static void load_state(void);
 
-// board state
-BB pos_pieces[12];
-BB pos_occupancies[3]; // 0 = White, 1 = Black, 2 = Both
-int pos_occupancy[64];
-int pos_side = 1;
-int pos_ep = none;
-int pos_castling;
-int pos_cap_piece = 0;
-
-int_stack pos_moves = {{0}, 0};
+// board state, one board per thread
+_Thread_local BB pos_pieces[12];
+_Thread_local BB pos_occupancies[3]; // 0 = White, 1 = Black, 2 = Both
+_Thread_local int pos_occupancy[64];
+_Thread_local int pos_side = 1;
+_Thread_local int pos_ep = none;
+_Thread_local int pos_castling;
+_Thread_local int pos_cap_piece = 0;
+_Thread_local int pos_halfmove = 0;
+_Thread_local int pos_fullmove = 1;
+_Thread_local BB pos_key = 0;
+_Thread_local BB pos_key_history[1000]; // pos_key before each move of pos_moves, same index
+_Thread_local EvalState pos_eval;
+_Thread_local EvalState pos_eval_history[1000]; // like pos_key_history
+
+_Thread_local int_stack pos_moves = {{0}, 0};
 
 /*
    0000 0000 0000 0000 0000 0000 0000 1111   pos_castling
    0000 0000 0000 0000 0000 0000 1111 0000   captured piece
    0000 0000 0000 0000 0111 1111 0000 0000   pos_ep
+   0000 0001 1111 1111 1000 0000 0000 0000   pos_halfmove
  */
 
-int_stack irrev_aspects = {{0},0};
+_Thread_local int_stack irrev_aspects = {{0},0};
 
 static void save_state(void) {
   unsigned int state = 0;
   state |= pos_castling;
   state |= pos_cap_piece << 4;
   state |= pos_ep << 8;
+  state |= pos_halfmove << 15;
   push(&irrev_aspects,state);
 }
 
@@ -42,6 +54,7 @@ static void load_state(void) {
   pos_castling = state & 15;
   pos_cap_piece = (state >> 4) & 15;
   pos_ep = (state >> 8) & 127;
+  pos_halfmove = (state >> 15) & 1023;
 }
 
 
@@ -67,6 +80,10 @@ const char *square_to_coordinates[] = {
 void make_move(MOVE const move) {
 
   save_state(); //save irreversibe aspects of the position, since they are about to be modified 
+  pos_key_history[pos_moves.index] = pos_key;
+  pos_eval_history[pos_moves.index] = pos_eval;
+  int const old_castling = pos_castling;
+  int const old_ep = pos_ep;
 
   int const piece = GET_MOVE_PIECE(move);
   int const source = GET_MOVE_SOURCE(move);
@@ -244,6 +261,47 @@ void make_move(MOVE const move) {
   }
 
 
+  // zobrist key and evaluation terms, from the squares that changed
+  int const placed = prom_piece ? prom_piece : piece;
+  BB key = pos_key ^ side_key ^ castling_keys[old_castling] ^ castling_keys[pos_castling];
+  key ^= ep_keys[old_ep] ^ ep_keys[pos_ep];
+  key ^= piece_keys[piece][source] ^ piece_keys[placed][target];
+  pos_eval.mg += psq_mg[placed][target] - psq_mg[piece][source];
+  pos_eval.eg += psq_eg[placed][target] - psq_eg[piece][source];
+  if (prom_piece) {
+    pos_eval.phase += piece_phase[prom_piece];
+    pos_eval.material[pos_side] += material_value[prom_piece] - material_value[piece];
+    pos_eval.signature += (1ULL << (4 * prom_piece)) - (1ULL << (4 * piece));
+  }
+  if (GET_MOVE_CAPTURE(move)) {
+    int const square = GET_MOVE_EP(move) ? (pos_side == WHITE ? old_ep + 8 : old_ep - 8) : target;
+    key ^= piece_keys[pos_cap_piece][square];
+    pos_eval.mg -= psq_mg[pos_cap_piece][square];
+    pos_eval.eg -= psq_eg[pos_cap_piece][square];
+    pos_eval.phase -= piece_phase[pos_cap_piece];
+    pos_eval.material[!pos_side] -= material_value[pos_cap_piece];
+    pos_eval.signature -= 1ULL << (4 * pos_cap_piece);
+  }
+  if (GET_MOVE_CASTLING(move)) {
+    int const rook = pos_side == WHITE ? R : r;
+    int const kingside = target == g1 || target == g8;
+    int const from = kingside ? target + 1 : target - 2;
+    int const to = kingside ? target - 1 : target + 1;
+    key ^= piece_keys[rook][from] ^ piece_keys[rook][to];
+    pos_eval.mg += psq_mg[rook][to] - psq_mg[rook][from];
+    pos_eval.eg += psq_eg[rook][to] - psq_eg[rook][from];
+  }
+  pos_key = key;
+  if (nnue_enabled)
+    nnue_make_move(move, pos_cap_piece);
+
+  // fifty-move clock, capped to fit the saved state
+  if (piece == P || piece == p || GET_MOVE_CAPTURE(move))
+    pos_halfmove = 0;
+  else if (pos_halfmove < 1023)
+    pos_halfmove++;
+  pos_fullmove += pos_side; // a new move number starts after black's move
+
   push(&pos_moves, move); // push new move
   pos_side = !(pos_side); // change turns
 }
@@ -351,6 +409,77 @@ void takeback(void) {
 
   load_state();
   pos_side = !pos_side;                    // change turn
+  pos_fullmove -= pos_side;
+  pos_key = pos_key_history[pos_moves.index];
+  pos_eval = pos_eval_history[pos_moves.index];
+}
+
+/*
+ * Passes the turn, for null move pruning. A null move resets the
+ * fifty-move clock, so that repetitions are not detected across it.
+ * Must be undone with takeback_null_move().
+ */
+void make_null_move(void) {
+  save_state();
+  pos_key_history[pos_moves.index] = pos_key;
+  pos_key ^= side_key ^ ep_keys[pos_ep];
+  pos_ep = none;
+  pos_halfmove = 0;
+  pos_fullmove += pos_side;
+  if (nnue_enabled)
+    nnue_null_move();
+  push(&pos_moves, 0);
+  pos_side = !pos_side;
+}
+
+void takeback_null_move(void) {
+  pop(&pos_moves);
+  load_state();
+  pos_side = !pos_side;
+  pos_fullmove -= pos_side;
+  pos_key = pos_key_history[pos_moves.index];
+}
+
+/*
+ * Copies the board of the calling thread, including the move history
+ * needed to take moves back and to detect repetitions, so that it can
+ * be set up on another thread with board_restore().
+ */
+void board_snapshot(BoardSnapshot *const out) {
+  memcpy(out->pieces, pos_pieces, sizeof(pos_pieces));
+  memcpy(out->occupancies, pos_occupancies, sizeof(pos_occupancies));
+  memcpy(out->occupancy, pos_occupancy, sizeof(pos_occupancy));
+  out->side = pos_side;
+  out->ep = pos_ep;
+  out->castling = pos_castling;
+  out->cap_piece = pos_cap_piece;
+  out->halfmove = pos_halfmove;
+  out->fullmove = pos_fullmove;
+  out->key = pos_key;
+  out->eval = pos_eval;
+  out->moves = pos_moves;
+  out->irrev_aspects = irrev_aspects;
+  memcpy(out->key_history, pos_key_history, pos_moves.index * sizeof(BB));
+  memcpy(out->eval_history, pos_eval_history, pos_moves.index * sizeof(EvalState));
+}
+
+void board_restore(BoardSnapshot const *const in) {
+  memcpy(pos_pieces, in->pieces, sizeof(pos_pieces));
+  memcpy(pos_occupancies, in->occupancies, sizeof(pos_occupancies));
+  memcpy(pos_occupancy, in->occupancy, sizeof(pos_occupancy));
+  pos_side = in->side;
+  pos_ep = in->ep;
+  pos_castling = in->castling;
+  pos_cap_piece = in->cap_piece;
+  pos_halfmove = in->halfmove;
+  pos_fullmove = in->fullmove;
+  pos_key = in->key;
+  pos_eval = in->eval;
+  pos_moves = in->moves;
+  irrev_aspects = in->irrev_aspects;
+  memcpy(pos_key_history, in->key_history, in->moves.index * sizeof(BB));
+  memcpy(pos_eval_history, in->eval_history, in->moves.index * sizeof(EvalState));
+  nnue_invalidate();
 }
 
 // int_stack functions
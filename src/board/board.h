@@ -7,6 +7,12 @@
 #define NOT_GH 0x3F3F3F3F3F3F3F3FULL
 #define NOT_A 0xFEFEFEFEFEFEFEFEULL
 #define NOT_AB 0xFCFCFCFCFCFCFCFCULL
+#define RANK_8 0x00000000000000FFULL
+#define RANK_6 0x0000000000FF0000ULL
+#define RANK_3 0x0000FF0000000000ULL
+#define RANK_1 0xFF00000000000000ULL
+#define PROMOTION_RANKS (RANK_1 | RANK_8)
+#define LIGHT_SQUARES 0xAA55AA55AA55AA55ULL
 #define NOT_H1 ~(1ULL << h1)
 #define F1 1ULL << f1
 #define NOT_A1 ~(1ULL << a1)
@@ -27,6 +33,10 @@
 #define D1C1B1 ((1ULL << d1) | (1ULL << c1) | (1ULL << b1))
 #define F8G8 ((1ULL << f8) | (1ULL << g8))
 #define D8C8B8 ((1ULL << d8) | (1ULL << c8) | (1ULL << b8))
+#define E1F1G1 ((1ULL << e1) | (1ULL << f1) | (1ULL << g1))
+#define E1D1C1 ((1ULL << e1) | (1ULL << d1) | (1ULL << c1))
+#define E8F8G8 ((1ULL << e8) | (1ULL << f8) | (1ULL << g8))
+#define E8D8C8 ((1ULL << e8) | (1ULL << d8) | (1ULL << c8))
 
 #define IS_SET(bitboard, square) bitboard & (1ULL << square)
 #define SET_BIT(bitboard, bit_nr) bitboard |= (1ULL << bit_nr)
@@ -90,20 +100,66 @@ enum { wk = 1, wq = 2, bk = 4, bq = 8 };
 enum { P, N, B, R, Q, K, p, n, b, r, q, k };
 
 
+/*
+ * Evaluation terms kept up to date by make_move(), see eval.c.
+ * mg and eg include material and are from white's point of view.
+ */
+typedef struct EvalState {
+  int mg;
+  int eg;
+  int phase; // 24 with all pieces on the board, more after promotions
+  int material[2]; // without kings
+  BB signature; // count of each piece P..k, 4 bits each
+} EvalState;
+
+#define MATERIAL_COUNT(signature, piece) (((signature) >> (4 * (piece))) & 15)
+
 extern const char ascii_pieces[12];
 extern const int char_pieces[];
 extern const int promoted_pieces[];
 extern const char *square_to_coordinates[];
-extern BB pos_pieces[12];
-extern BB pos_occupancies[3];
-extern int pos_occupancy[64];
-extern int pos_side;
-extern int pos_ep;
-extern int pos_castling;
-extern int pos_cap_piece;
-extern int_stack irrev_aspects;
-extern int_stack pos_moves;
+extern _Thread_local BB pos_pieces[12];
+extern _Thread_local BB pos_occupancies[3];
+extern _Thread_local int pos_occupancy[64];
+extern _Thread_local int pos_side;
+extern _Thread_local int pos_ep;
+extern _Thread_local int pos_castling;
+extern _Thread_local int pos_cap_piece;
+extern _Thread_local int pos_halfmove;
+extern _Thread_local int pos_fullmove;
+extern _Thread_local BB pos_key;
+extern _Thread_local EvalState pos_eval;
+extern _Thread_local EvalState pos_eval_history[1000];
+extern _Thread_local BB pos_key_history[1000];
+extern _Thread_local int_stack irrev_aspects;
+extern _Thread_local int_stack pos_moves;
 void make_move(MOVE move);
 void takeback(void);
+void make_null_move(void);
+void takeback_null_move(void);
+
+/*
+ * Copy of a thread's board, see board_snapshot()
+ */
+typedef struct BoardSnapshot {
+  BB pieces[12];
+  BB occupancies[3];
+  int occupancy[64];
+  int side;
+  int ep;
+  int castling;
+  int cap_piece;
+  int halfmove;
+  int fullmove;
+  BB key;
+  EvalState eval;
+  int_stack moves;
+  int_stack irrev_aspects;
+  BB key_history[1000];
+  EvalState eval_history[1000];
+} BoardSnapshot;
+
+void board_snapshot(BoardSnapshot *out);
+void board_restore(BoardSnapshot const *in);
 
 #endif
@@ -4,7 +4,20 @@
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include "../zobrist/zobrist.h"
+#include "../eval/eval.h"
+#include "../nnue/nnue.h"
+#include "../generator/generator.h"
 #include "board_utils.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+static BB slider_attacks(BB orthogonal, BB diagonal, BB occupancy);
+static void fen_error(void);
+static bool fen_reject(void);
+static int count_repetitions(int limit);
+static bool is_ep_square_valid(void);
 
 
 bool is_square_attacked(int const square, int const side) { // attacking side
@@ -27,12 +40,239 @@ bool is_square_attacked(int const square, int const side) { // attacking side
 
 }
 
+/*
+ * Kogge-Stone occluded fills for all rays of all sliders at once.
+ * The 8 directions are split in two groups of 4 (shifting towards h1
+ * and towards a8); with AVX2 each group is filled in a single register,
+ * one direction per 64-bit lane.
+ *
+ *   shift 8: north / south
+ *   shift 1: east  / west
+ *   shift 9: south-east / north-west
+ *   shift 7: south-west / north-east
+ */
+static BB slider_attacks(BB const orthogonal, BB const diagonal, BB const occupancy) {
+  BB const empty = ~occupancy;
+
+#ifdef __AVX2__
+  __m256i const shift1 = _mm256_setr_epi64x(8, 1, 9, 7);
+  __m256i const shift2 = _mm256_add_epi64(shift1, shift1);
+  __m256i const shift4 = _mm256_add_epi64(shift2, shift2);
+  __m256i const sliders = _mm256_setr_epi64x((long long)orthogonal, (long long)orthogonal,
+                                             (long long)diagonal, (long long)diagonal);
+  __m256i const empty_v = _mm256_set1_epi64x((long long)empty);
+  __m256i const up_mask = _mm256_setr_epi64x(-1LL, (long long)NOT_A, (long long)NOT_A, (long long)NOT_H);
+  __m256i const down_mask = _mm256_setr_epi64x(-1LL, (long long)NOT_H, (long long)NOT_H, (long long)NOT_A);
+
+  // towards h1 (left shifts)
+  __m256i gen = sliders;
+  __m256i pro = _mm256_and_si256(empty_v, up_mask);
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_sllv_epi64(gen, shift1)));
+  pro = _mm256_and_si256(pro, _mm256_sllv_epi64(pro, shift1));
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_sllv_epi64(gen, shift2)));
+  pro = _mm256_and_si256(pro, _mm256_sllv_epi64(pro, shift2));
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_sllv_epi64(gen, shift4)));
+  __m256i attacks = _mm256_and_si256(_mm256_sllv_epi64(gen, shift1), up_mask);
+
+  // towards a8 (right shifts)
+  gen = sliders;
+  pro = _mm256_and_si256(empty_v, down_mask);
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srlv_epi64(gen, shift1)));
+  pro = _mm256_and_si256(pro, _mm256_srlv_epi64(pro, shift1));
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srlv_epi64(gen, shift2)));
+  pro = _mm256_and_si256(pro, _mm256_srlv_epi64(pro, shift2));
+  gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srlv_epi64(gen, shift4)));
+  attacks = _mm256_or_si256(attacks, _mm256_and_si256(_mm256_srlv_epi64(gen, shift1), down_mask));
+
+  __m128i const half = _mm_or_si128(_mm256_castsi256_si128(attacks), _mm256_extracti128_si256(attacks, 1));
+  return (BB)_mm_cvtsi128_si64(half) | (BB)_mm_extract_epi64(half, 1);
+#else
+  static const int shifts[4] = {8, 1, 9, 7};
+  static const BB up_masks[4] = {~0ULL, NOT_A, NOT_A, NOT_H};
+  static const BB down_masks[4] = {~0ULL, NOT_H, NOT_H, NOT_A};
+  BB attacks = 0ULL;
+
+  for (int dir = 0; dir < 4; dir++) {
+    int const s = shifts[dir];
+    BB const sliders = dir < 2 ? orthogonal : diagonal;
+    BB gen = sliders;
+    BB pro = empty & up_masks[dir];
+    gen |= pro & (gen << s);
+    pro &= pro << s;
+    gen |= pro & (gen << 2 * s);
+    pro &= pro << 2 * s;
+    gen |= pro & (gen << 4 * s);
+    attacks |= (gen << s) & up_masks[dir];
+
+    gen = sliders;
+    pro = empty & down_masks[dir];
+    gen |= pro & (gen >> s);
+    pro &= pro >> s;
+    gen |= pro & (gen >> 2 * s);
+    pro &= pro >> 2 * s;
+    gen |= pro & (gen >> 4 * s);
+    attacks |= (gen >> s) & down_masks[dir];
+  }
+  return attacks;
+#endif
+}
+
+BB compute_attacks_with_occupancy(int const side, BB const occupancy) {
+  int const offset = side == WHITE ? P : p;
+  BB const pawns = pos_pieces[offset + P];
+  BB const knights = pos_pieces[offset + N];
+  BB const king = pos_pieces[offset + K];
+  BB const queens = pos_pieces[offset + Q];
+  BB attacks;
+
+  if (side == WHITE)
+    attacks = (pawns >> 7 & NOT_A) | (pawns >> 9 & NOT_H);
+  else
+    attacks = (pawns << 7 & NOT_H) | (pawns << 9 & NOT_A);
+
+  attacks |= knights >> 6 & NOT_AB;
+  attacks |= knights << 6 & NOT_GH;
+  attacks |= knights >> 10 & NOT_GH;
+  attacks |= knights << 10 & NOT_AB;
+  attacks |= knights >> 15 & NOT_A;
+  attacks |= knights << 15 & NOT_H;
+  attacks |= knights >> 17 & NOT_H;
+  attacks |= knights << 17 & NOT_A;
+
+  attacks |= king >> 1 & NOT_H;
+  attacks |= king << 1 & NOT_A;
+  attacks |= king >> 7 & NOT_A;
+  attacks |= king << 7 & NOT_H;
+  attacks |= king >> 8;
+  attacks |= king << 8;
+  attacks |= king >> 9 & NOT_H;
+  attacks |= king << 9 & NOT_A;
+
+  attacks |= slider_attacks(pos_pieces[offset + R] | queens, pos_pieces[offset + B] | queens, occupancy);
+
+  return attacks;
+}
+
+BB compute_attacks(int const side) {
+  return compute_attacks_with_occupancy(side, pos_occupancies[BOTH]);
+}
+
+BB attackers_to(int const square, BB const occupancy) {
+  return
+      (get_pawn_attacks(square, BLACK) & pos_pieces[P]) |
+      (get_pawn_attacks(square, WHITE) & pos_pieces[p]) |
+      (get_knight_attacks(square) & (pos_pieces[N] | pos_pieces[n])) |
+      (get_king_attacks(square) & (pos_pieces[K] | pos_pieces[k])) |
+      (get_bishop_attacks(square, occupancy) & (pos_pieces[B] | pos_pieces[b] | pos_pieces[Q] | pos_pieces[q])) |
+      (get_rook_attacks(square, occupancy) & (pos_pieces[R] | pos_pieces[r] | pos_pieces[Q] | pos_pieces[q]));
+}
+
+/*
+ * Neither side can mate: no pawns, rooks or queens, and either at
+ * most one minor piece or only bishops, all on squares of one colour.
+ */
+bool is_insufficient_material(void) {
+  if (pos_pieces[P] | pos_pieces[p] | pos_pieces[R] | pos_pieces[r] | pos_pieces[Q] | pos_pieces[q])
+    return false;
+
+  BB const bishops = pos_pieces[B] | pos_pieces[b];
+  BB const minors = bishops | pos_pieces[N] | pos_pieces[n];
+
+  if (POPCNT(minors) <= 1)
+    return true;
+  return minors == bishops && (!(bishops & LIGHT_SQUARES) || !(bishops & ~LIGHT_SQUARES));
+}
+
+/*
+ * Counts the earlier occurrences of the current position in the key
+ * history. Only positions since the last capture, pawn move or null
+ * move can be the same, and only every second one has the same side
+ * to move, which bounds the scan by pos_halfmove / 2 keys.
+ * @param limit Stop counting at this many
+ */
+static int count_repetitions(int const limit) {
+  int const first = pos_moves.index - pos_halfmove;
+  int count = 0;
+
+  for (int i = pos_moves.index - 4; i >= 0 && i >= first; i -= 2)
+    if (pos_key_history[i] == pos_key && ++count == limit)
+      break;
+  return count;
+}
+
+bool is_repetition(void) {
+  return count_repetitions(1) > 0;
+}
+
+bool is_threefold_repetition(void) {
+  return count_repetitions(2) == 2;
+}
+
+/*
+ * A mate given with the hundredth ply still wins.
+ */
+bool is_fifty_move_draw(void) {
+  return pos_halfmove >= 100 && (!IS_KING_IN_CHECK(pos_side) || has_legal_move());
+}
+
+bool is_draw(void) {
+  return is_fifty_move_draw() || is_threefold_repetition() || is_insufficient_material();
+}
+
+/*
+ * Writes the FEN of the global board, the inverse of parse_fen().
+ * @returns The length of the FEN, as snprintf()
+ */
+int board_to_fen(char *const out, size_t const size) {
+  char placement[72];
+  char castling[5];
+  int length = 0;
+
+  for (int rank = 0; rank < 8; rank++) {
+    int empty = 0;
+    for (int square = rank * 8; square < rank * 8 + 8; square++) {
+      if (pos_occupancy[square] == INT_MAX) {
+        empty++;
+        continue;
+      }
+      if (empty)
+        placement[length++] = '0' + empty;
+      empty = 0;
+      placement[length++] = ascii_pieces[pos_occupancy[square]];
+    }
+    if (empty)
+      placement[length++] = '0' + empty;
+    if (rank < 7)
+      placement[length++] = '/';
+  }
+  placement[length] = '\0';
+
+  length = 0;
+  if (pos_castling & wk) castling[length++] = 'K';
+  if (pos_castling & wq) castling[length++] = 'Q';
+  if (pos_castling & bk) castling[length++] = 'k';
+  if (pos_castling & bq) castling[length++] = 'q';
+  if (!length) castling[length++] = '-';
+  castling[length] = '\0';
+
+  return snprintf(out, size, "%s %c %s %s %d %d", placement, pos_side == WHITE ? 'w' : 'b', castling,
+                  pos_ep == none ? "-" : square_to_coordinates[pos_ep], pos_halfmove, pos_fullmove);
+}
+
 static void fen_error(void) {
   printf("Invalid FEN string\n");
   exit(1);
 }
 
-static void clean_board(void) {
+static bool fen_reject(void) {
+  clean_board();
+  return false;
+}
+
+/*
+ * Empties the global board and resets all state to its defaults.
+ */
+void clean_board(void) {
   for (size_t i = 0; i < sizeof(pos_pieces)/sizeof(pos_pieces[0]); i++)
     pos_pieces[i]=0ULL;
 
@@ -45,13 +285,74 @@ static void clean_board(void) {
   pos_moves.index = 0;
   irrev_aspects.index = 0; 
   pos_ep = none;
+  pos_castling = 0;
   pos_cap_piece = 0;
+  pos_halfmove = 0;
+  pos_fullmove = 1;
+  pos_key = 0;
+  pos_eval = (EvalState) {0};
+  nnue_invalidate();
+}
+
+/*
+ * An ep square has to be behind a pawn of the side not to move that
+ * just advanced two squares: the ep square and the pawn's origin are
+ * empty, the pawn stands in front of the ep square.
+ * @returns true for pos_ep == none
+ */
+static bool is_ep_square_valid(void) {
+  if (pos_ep == none)
+    return true;
+  if (pos_ep > none || pos_ep / 8 != (pos_side == WHITE ? 2 : 5))
+    return false;
 
+  int const forward = pos_side == WHITE ? 8 : -8; // from the ep square towards the pawn
+  return pos_occupancy[pos_ep] == INT_MAX &&
+         pos_occupancy[pos_ep - forward] == INT_MAX &&
+         pos_occupancy[pos_ep + forward] == (pos_side == WHITE ? p : P);
+}
+
+/*
+ * Checks a position set up square by square (pieces, side, castling
+ * and ep square): each side needs exactly one king, no pawn may
+ * stand on the first or last rank, the ep square must be behind a
+ * pawn that just advanced two squares and the side not to move may
+ * not be in check. Castling rights without the king and rook on
+ * their squares are dropped.
+ * @returns false if the position is illegal
+ */
+bool validate_position(void) {
+  if (POPCNT(pos_pieces[K]) != 1 || POPCNT(pos_pieces[k]) != 1 ||
+      ((pos_pieces[P] | pos_pieces[p]) & PROMOTION_RANKS) || !is_ep_square_valid())
+    return false;
+
+  if (pos_occupancy[e1] != K) pos_castling &= ~(wk | wq);
+  if (pos_occupancy[h1] != R) pos_castling &= ~wk;
+  if (pos_occupancy[a1] != R) pos_castling &= ~wq;
+  if (pos_occupancy[e8] != k) pos_castling &= ~(bk | bq);
+  if (pos_occupancy[h8] != r) pos_castling &= ~bk;
+  if (pos_occupancy[a8] != r) pos_castling &= ~bq;
+
+  return !IS_KING_IN_CHECK(!pos_side);
 }
 
 void parse_fen(char *fen_string) {
-  if (strlen(fen_string) < 24 || strlen(fen_string) > 80)
+  if (!load_fen(fen_string))
     fen_error();
+}
+
+/*
+ * Sets up the global board from a FEN string. Unlike parse_fen(),
+ * malformed or illegal positions are reported instead of ending the
+ * program, so that untrusted input can be handled: the squares must
+ * add up and the position has to pass validate_position().
+ * @returns false (leaving an empty board) if the FEN is rejected
+ */
+bool load_fen(char const *fen_string) {
+  if (strlen(fen_string) > 100) {
+    clean_board();
+    return false;
+  }
 
   int fen_index;
   int square = 0;
@@ -59,20 +360,28 @@ void parse_fen(char *fen_string) {
 
   clean_board();
   // Piece Placement Data
-  for (fen_index = 0; fen_index <= 72; fen_index++) {
+  for (fen_index = 0; fen_string[fen_index] != ' '; fen_index++) {
     ch = fen_string[fen_index];
-    if (ch == ' ')
-      break;
     if (ch >= '1' && ch <= '8') {
       square += ch - '0';
-    } else if (ch != '/') {
-      pos_pieces[char_pieces[ch]] |= 1ULL << square;
-      pos_occupancy[square] = char_pieces[ch];
+    } else if (ch == '/') {
+      if (square % 8 != 0)
+        return fen_reject();
+    } else {
+      char const *const piece = ch ? strchr(ascii_pieces, ch) : NULL;
+      if (!piece || square >= 64)
+        return fen_reject();
+      pos_pieces[piece - ascii_pieces] |= 1ULL << square;
+      pos_occupancy[square] = piece - ascii_pieces;
       pos_occupancies[BOTH] |= 1ULL << square;
       pos_occupancies[ch > 'Z' ? BLACK : WHITE] |= 1ULL << square;
       square++;
     }
+    if (square > 64)
+      return fen_reject();
   }
+  if (square != 64)
+    return fen_reject();
 
   // Active Color
   fen_index++;
@@ -82,10 +391,13 @@ void parse_fen(char *fen_string) {
   else if (ch == 'b')
     pos_side = BLACK;
   else
-    fen_error();
+    return fen_reject();
 
   //pos_castling
-  fen_index += 2;
+  fen_index++;
+  if (fen_string[fen_index] != ' ')
+    return fen_reject();
+  fen_index++;
 
   while (1) {
     ch = fen_string[fen_index];
@@ -109,8 +421,7 @@ void parse_fen(char *fen_string) {
         pos_castling = 0;
         break;
       default:
-        fen_error();
-
+        return fen_reject();
     }
     fen_index++;
   }
@@ -121,9 +432,26 @@ void parse_fen(char *fen_string) {
   if (fen_string[fen_index] == '-') {
     pos_ep = none;
   } else {
-    pos_ep = fen_string[fen_index] - 'a';
+    ch = fen_string[fen_index];
+    if (ch < 'a' || ch > 'h' || fen_string[fen_index + 1] != (pos_side == WHITE ? '6' : '3'))
+      return fen_reject();
+    pos_ep = ch - 'a';
     pos_ep += ('8' - fen_string[fen_index + 1]) * 8;
+    fen_index++;
   }
 
+  // optional halfmove clock and fullmove number
+  int halfmove, fullmove;
+  if (sscanf(fen_string + fen_index + 1, "%d %d", &halfmove, &fullmove) == 2) {
+    if (halfmove < 0 || halfmove > 1023 || fullmove < 1)
+      return fen_reject();
+    pos_halfmove = halfmove;
+    pos_fullmove = fullmove;
+  }
 
+  if (!validate_position())
+    return fen_reject();
+  pos_key = compute_key();
+  compute_eval_state(&pos_eval);
+  return true;
 }
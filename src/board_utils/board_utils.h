@@ -1,7 +1,21 @@
 #ifndef SPARK_BOARD_UTILS_H
 #define SPARK_BOARD_UTILS_H
 #include <stdbool.h>
+#include <stddef.h>
+#include "../Types.h"
 
 bool is_square_attacked(int square, int side);
+BB compute_attacks(int side);
+BB compute_attacks_with_occupancy(int side, BB occupancy);
+BB attackers_to(int square, BB occupancy);
+bool is_insufficient_material(void);
+bool is_repetition(void);
+bool is_threefold_repetition(void);
+bool is_fifty_move_draw(void);
+bool is_draw(void);
 void parse_fen(char *fen_string);
+bool load_fen(char const *fen_string);
+bool validate_position(void);
+void clean_board(void);
+int board_to_fen(char *out, size_t size);
 #endif
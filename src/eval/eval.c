@@ -0,0 +1,153 @@
+#include "../board/board.h"
+#include "../nnue/nnue.h"
+#include "eval.h"
+
+/*
+ * Static evaluation: material and piece-square tables (the
+ * "simplified evaluation function" values). The king table is
+ * interpolated between middlegame and endgame by the remaining
+ * non-pawn material. Tables are laid out like the board, a8 first,
+ * from white's point of view; black squares are mirrored with ^ 56.
+ *
+ * The board keeps the sums of psq_mg/psq_eg (material included) in
+ * pos_eval, updated by make_move(), so evaluate() only interpolates.
+ * With nnue_enable(), the network's evaluation is used instead.
+ */
+
+#define PHASE_TOTAL 24 // 4 knights and bishops, 4 rooks, 2 queens
+
+static const int piece_value[6] = {100, 320, 330, 500, 900, 0};
+static const int phase_of[6] = {0, 1, 1, 2, 4, 0};
+
+// material plus piece-square value, negative for black
+int psq_mg[12][64];
+int psq_eg[12][64];
+int piece_phase[12];
+int material_value[12];
+
+static const int pst[6][64] = {
+  { // pawn
+     0,  0,  0,  0,  0,  0,  0,  0,
+    50, 50, 50, 50, 50, 50, 50, 50,
+    10, 10, 20, 30, 30, 20, 10, 10,
+     5,  5, 10, 25, 25, 10,  5,  5,
+     0,  0,  0, 20, 20,  0,  0,  0,
+     5, -5,-10,  0,  0,-10, -5,  5,
+     5, 10, 10,-20,-20, 10, 10,  5,
+     0,  0,  0,  0,  0,  0,  0,  0
+  },
+  { // knight
+   -50,-40,-30,-30,-30,-30,-40,-50,
+   -40,-20,  0,  0,  0,  0,-20,-40,
+   -30,  0, 10, 15, 15, 10,  0,-30,
+   -30,  5, 15, 20, 20, 15,  5,-30,
+   -30,  0, 15, 20, 20, 15,  0,-30,
+   -30,  5, 10, 15, 15, 10,  5,-30,
+   -40,-20,  0,  5,  5,  0,-20,-40,
+   -50,-40,-30,-30,-30,-30,-40,-50
+  },
+  { // bishop
+   -20,-10,-10,-10,-10,-10,-10,-20,
+   -10,  0,  0,  0,  0,  0,  0,-10,
+   -10,  0,  5, 10, 10,  5,  0,-10,
+   -10,  5,  5, 10, 10,  5,  5,-10,
+   -10,  0, 10, 10, 10, 10,  0,-10,
+   -10, 10, 10, 10, 10, 10, 10,-10,
+   -10,  5,  0,  0,  0,  0,  5,-10,
+   -20,-10,-10,-10,-10,-10,-10,-20
+  },
+  { // rook
+     0,  0,  0,  0,  0,  0,  0,  0,
+     5, 10, 10, 10, 10, 10, 10,  5,
+    -5,  0,  0,  0,  0,  0,  0, -5,
+    -5,  0,  0,  0,  0,  0,  0, -5,
+    -5,  0,  0,  0,  0,  0,  0, -5,
+    -5,  0,  0,  0,  0,  0,  0, -5,
+    -5,  0,  0,  0,  0,  0,  0, -5,
+     0,  0,  0,  5,  5,  0,  0,  0
+  },
+  { // queen
+   -20,-10,-10, -5, -5,-10,-10,-20,
+   -10,  0,  0,  0,  0,  0,  0,-10,
+   -10,  0,  5,  5,  5,  5,  0,-10,
+    -5,  0,  5,  5,  5,  5,  0, -5,
+     0,  0,  5,  5,  5,  5,  0, -5,
+   -10,  5,  5,  5,  5,  5,  0,-10,
+   -10,  0,  5,  0,  0,  0,  0,-10,
+   -20,-10,-10, -5, -5,-10,-10,-20
+  },
+  { // king, middlegame
+   -30,-40,-40,-50,-50,-40,-40,-30,
+   -30,-40,-40,-50,-50,-40,-40,-30,
+   -30,-40,-40,-50,-50,-40,-40,-30,
+   -30,-40,-40,-50,-50,-40,-40,-30,
+   -20,-30,-30,-40,-40,-30,-30,-20,
+   -10,-20,-20,-20,-20,-20,-20,-10,
+    20, 20,  0,  0,  0,  0, 20, 20,
+    20, 30, 10,  0,  0, 10, 30, 20
+  }
+};
+
+static const int king_endgame[64] = {
+   -50,-40,-30,-20,-20,-30,-40,-50,
+   -30,-20,-10,  0,  0,-10,-20,-30,
+   -30,-10, 20, 30, 30, 20,-10,-30,
+   -30,-10, 30, 40, 40, 30,-10,-30,
+   -30,-10, 30, 40, 40, 30,-10,-30,
+   -30,-10, 20, 30, 30, 20,-10,-30,
+   -30,-30,  0,  0,  0,  0,-30,-30,
+   -50,-30,-30,-30,-30,-30,-30,-50
+};
+
+void init_eval(void) {
+  for (int type = P; type <= K; type++) {
+    piece_phase[type] = piece_phase[type + p] = phase_of[type];
+    material_value[type] = material_value[type + p] = piece_value[type];
+
+    for (int square = 0; square < 64; square++) {
+      int const mg = pst[type][square];
+      int const eg = type == K ? king_endgame[square] : mg;
+      psq_mg[type][square] = piece_value[type] + mg;
+      psq_eg[type][square] = piece_value[type] + eg;
+      psq_mg[type + p][square ^ 56] = -psq_mg[type][square];
+      psq_eg[type + p][square ^ 56] = -psq_eg[type][square];
+    }
+  }
+}
+
+/*
+ * Computes the evaluation state of the current position from
+ * scratch, see EvalState.
+ */
+void compute_eval_state(EvalState *const out) {
+  *out = (EvalState) {0};
+
+  for (int piece = P; piece <= k; piece++) {
+    BB bitboard = pos_pieces[piece];
+    int const count = POPCNT(bitboard);
+
+    out->phase += piece_phase[piece] * count;
+    out->material[piece < p ? WHITE : BLACK] += material_value[piece] * count;
+    out->signature += (BB) count << (4 * piece);
+    while (bitboard) {
+      int const square = FIRST_SET_BIT(bitboard);
+      out->mg += psq_mg[piece][square];
+      out->eg += psq_eg[piece][square];
+      bitboard &= bitboard - 1;
+    }
+  }
+}
+
+/*
+ * @returns The score in centipawns from the point of view of the
+ *          side to move
+ */
+int evaluate(void) {
+  if (nnue_enabled)
+    return nnue_evaluate();
+
+  int const phase = pos_eval.phase < PHASE_TOTAL ? pos_eval.phase : PHASE_TOTAL; // promotions
+  int const score = (phase * pos_eval.mg + (PHASE_TOTAL - phase) * pos_eval.eg) / PHASE_TOTAL;
+
+  return pos_side == WHITE ? score : -score;
+}
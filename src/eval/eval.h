@@ -0,0 +1,15 @@
+#ifndef SPARK_EVAL_H
+#define SPARK_EVAL_H
+
+#include "../board/board.h"
+
+extern int psq_mg[12][64];
+extern int psq_eg[12][64];
+extern int piece_phase[12];
+extern int material_value[12];
+
+void init_eval(void);
+void compute_eval_state(EvalState *out);
+int evaluate(void);
+
+#endif
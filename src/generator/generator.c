@@ -1,3 +1,4 @@
+#include <stdatomic.h>
 #include <stdio.h>
 #include <limits.h>
 #include "../attack_tables/attack_tables.h"
@@ -8,9 +9,27 @@
 
 static void add_prio(MoveList *mlist, MOVE move);
 static void sort_caps(MoveList *mlist);
-static void add_move(MoveList *mlist, MOVE move);
+static int count_pawn_moves(int side, BB pawns, BB mask);
+static bool is_ep_legal(int source, int king_sq, BB checkers);
+static BB find_checkers(int side, int king_sq);
+static BB find_blockers(int king_sq, int slider_side, int blocker_side);
+static void init_check_info(void);
+static bool move_gives_check(MOVE move);
+static bool special_move_gives_check(MOVE move);
+static BB count_nodes(int depth);
+
+_Thread_local int nextCapIndex = 0;
+
+// gives-check detection, see init_check_info(); per thread like the board
+static _Thread_local bool check_flags = false;
+static _Thread_local int check_king_sq;
+static _Thread_local BB check_squares[6];
+static _Thread_local BB check_discoverers;
+
+// perft(): one move list per remaining depth, so that recursion doesn't put a list on the stack
+static _Thread_local MoveList perft_stack[MAX_PERFT_DEPTH + 1];
+static atomic_bool perft_stopped;
 
-int nextCapIndex = 0;
 static const int piece_values[] = {
   [P] = 1, [p] = 1,
   [N] = 3, [n] = 3,
@@ -19,26 +38,43 @@ static const int piece_values[] = {
   [Q] = 9, [q] = 9,
   [K] = 999, [k] = 999
 };
+/*
+ * The generator is written once for both colours. The helpers below
+ * take the side to move as a constant argument and are forced inline
+ * into generate_side(), which generate_moves_into() instantiates for
+ * WHITE and for BLACK, so every colour test folds away at compile time.
+ */
+#define SIDE_INLINE static inline __attribute__((always_inline))
+#define BY_SIDE(side, white, black) ((side) == WHITE ? (white) : (black))
+
+// White pawns move towards a8 (>>), black pawns towards h1 (<<).
+// West captures go towards the a-file, east captures towards the h-file.
+#define PAWN_PUSH(side, bb) BY_SIDE(side, (bb) >> 8, (bb) << 8)
+#define PAWN_WEST(side, bb) (BY_SIDE(side, (bb) >> 9, (bb) << 7) & NOT_H)
+#define PAWN_EAST(side, bb) (BY_SIDE(side, (bb) >> 7, (bb) << 9) & NOT_A)
+#define DOUBLE_PUSH_RANK(side) BY_SIDE(side, RANK_3, RANK_6)
+
 /*
  * A precheck is performed before resorting to
  * make-unmake: If the piece that is to move
  * is removed from the board and the moving side is not
  * in check, then the execution of this move can't 
- * possibly result in a check. Exceptions: king moves and EP!
+ * possibly result in a check. Exception: EP!
  * This is to avoid make/unmake whenever possible, as those
  * are expensive operations.
+ * King moves don't go through here, they are validated
+ * against the opponent's attack map in generate_side().
  */
-static void add_move(MoveList *mlist, MOVE const move) {
+static inline void add_move(MoveList *mlist, MOVE const move, int const side) {
 
- 
-  int piece = GET_MOVE_PIECE(move);
+  int const piece = GET_MOVE_PIECE(move);
 
   //precheck
-  if (piece != K && piece != k && !GET_MOVE_EP(move)) {
+  if (!GET_MOVE_EP(move)) {
     const BB sourceBB = 1ULL << GET_MOVE_SOURCE(move);
     pos_pieces[piece] &= ~(sourceBB);
     pos_occupancies[2] &= ~(sourceBB);
-    int isInCheck = IS_KING_IN_CHECK(pos_side);
+    int isInCheck = IS_KING_IN_CHECK(side);
     pos_pieces[piece] |= sourceBB;
     pos_occupancies[2] |= sourceBB;
     if (!isInCheck) {
@@ -49,20 +85,19 @@ static void add_move(MoveList *mlist, MOVE const move) {
 
  // full check
 
-make_move(move);
+  make_move(move);
+  bool const legal = !IS_KING_IN_CHECK(side);
+  takeback();
 
-if (!IS_KING_IN_CHECK((!pos_side))) { //legal move
-//    if (IS_KING_IN_CHECK(pos_side)) {
- //     move = SET_MOVE_CHECK(move); 
- //   }
+  if (legal) // added after takeback, so that add_prio() sees the original position
     add_prio(mlist, move);
-
-  }
-  takeback();
 }
 
 static void add_prio(MoveList *mlist, MOVE move) {
 
+  if (check_flags && move_gives_check(move))
+    move = SET_MOVE_CHECK(move);
+
   if (GET_MOVE_CAPTURE(move) || GET_MOVE_PROMOTION(move)) {
     if (nextCapIndex < mlist->current_index) {
       MOVE const temp = mlist->moves[nextCapIndex];
@@ -75,6 +110,182 @@ static void add_prio(MoveList *mlist, MOVE move) {
   mlist->moves[mlist->current_index++] = move;
 }
 
+/*
+ * Serializes pawn pushes by target square. The source square is
+ * target + delta.
+ */
+SIDE_INLINE void add_pawn_targets(MoveList *mlist, int const side, BB targets, int const delta) {
+  int const piece = BY_SIDE(side, P, p);
+  BB promotions = targets & PROMOTION_RANKS;
+  targets &= ~PROMOTION_RANKS;
+
+  while (targets) {
+    int const target = FIRST_SET_BIT(targets);
+    int const source = target + delta;
+    add_move(mlist, ENCODE_SIMPLE_MOVE(piece, source, target), side);
+    CLEAR_BIT(targets, target);
+  }
+
+  while (promotions) {
+    int const target = FIRST_SET_BIT(promotions);
+    int const source = target + delta;
+    add_move(mlist, ENCODE_PROM(piece, source, target, (piece + Q)), side);
+    add_move(mlist, ENCODE_PROM(piece, source, target, (piece + R)), side);
+    add_move(mlist, ENCODE_PROM(piece, source, target, (piece + B)), side);
+    add_move(mlist, ENCODE_PROM(piece, source, target, (piece + N)), side);
+    CLEAR_BIT(promotions, target);
+  }
+}
+
+/*
+ * Serializes pawn captures by target square. The source square is
+ * target + delta.
+ */
+SIDE_INLINE void add_pawn_captures(MoveList *mlist, int const side, BB targets, int const delta) {
+  int const piece = BY_SIDE(side, P, p);
+  BB promotions = targets & PROMOTION_RANKS;
+  targets &= ~PROMOTION_RANKS;
+
+  while (targets) {
+    int const target = FIRST_SET_BIT(targets);
+    int const source = target + delta;
+    add_move(mlist, ENCODE_SIMPLE_CAPTURE(piece, source, target), side);
+    CLEAR_BIT(targets, target);
+  }
+
+  while (promotions) {
+    int const target = FIRST_SET_BIT(promotions);
+    int const source = target + delta;
+    add_move(mlist, ENCODE_CAP_PROM(piece, source, target, (piece + Q)), side);
+    add_move(mlist, ENCODE_CAP_PROM(piece, source, target, (piece + R)), side);
+    add_move(mlist, ENCODE_CAP_PROM(piece, source, target, (piece + B)), side);
+    add_move(mlist, ENCODE_CAP_PROM(piece, source, target, (piece + N)), side);
+    CLEAR_BIT(promotions, target);
+  }
+}
+
+/*
+ * Setwise pawn move generation: pushes and captures of all pawns
+ * are computed with whole-bitboard shifts and then serialized by
+ * target square.
+ */
+SIDE_INLINE void add_pawn_moves(MoveList *mlist, int const side, BB const his_occ) {
+  int const piece = BY_SIDE(side, P, p);
+  BB const pawns = pos_pieces[piece];
+  BB const empty = ~pos_occupancies[BOTH];
+
+  BB const single = PAWN_PUSH(side, pawns) & empty;
+  add_pawn_targets(mlist, side, single, BY_SIDE(side, 8, -8));
+
+  BB targets = PAWN_PUSH(side, single & DOUBLE_PUSH_RANK(side)) & empty;
+  while (targets) {
+    int const target = FIRST_SET_BIT(targets);
+    add_move(mlist, ENCODE_DOUBLE(piece, (target + BY_SIDE(side, 16, -16)), target), side);
+    CLEAR_BIT(targets, target);
+  }
+
+  add_pawn_captures(mlist, side, PAWN_WEST(side, pawns) & his_occ, BY_SIDE(side, 9, -7));
+  add_pawn_captures(mlist, side, PAWN_EAST(side, pawns) & his_occ, BY_SIDE(side, 7, -9));
+
+  if (pos_ep != none) { // pawns attacking the ep square are found from the ep square itself
+    BB sources = get_pawn_attacks(pos_ep, !side) & pawns;
+    while (sources) {
+      int const source = FIRST_SET_BIT(sources);
+      add_move(mlist, ENCODE_EP(piece, source, pos_ep), side);
+      CLEAR_BIT(sources, source);
+    }
+  }
+}
+
+/*
+ * Knight, bishop, rook and queen moves. type is one of N, B, R, Q.
+ */
+SIDE_INLINE void add_piece_moves(MoveList *mlist, int const side, int const type, BB const his_occ) {
+  int const piece = BY_SIDE(side, P, p) + type;
+  BB const occ = pos_occupancies[BOTH];
+  BB const my_neg_occ = ~pos_occupancies[side]; // don't capture own pieces
+  BB bitboard = pos_pieces[piece];
+
+  while (bitboard) {
+    int const source = FIRST_SET_BIT(bitboard);
+    BB attacks;
+
+    switch (type) {
+      case N: attacks = get_knight_attacks(source); break;
+      case B: attacks = get_bishop_attacks(source, occ); break;
+      case R: attacks = get_rook_attacks(source, occ); break;
+      default: attacks = get_queen_attacks(source, occ); break;
+    }
+    attacks &= my_neg_occ;
+
+    while (attacks) { // loop over target squares
+      int const target = FIRST_SET_BIT(attacks);
+
+      if (IS_SET(his_occ, target)) {
+        add_move(mlist, ENCODE_SIMPLE_CAPTURE(piece, source, target), side);
+      } else {
+        add_move(mlist, ENCODE_SIMPLE_MOVE(piece, source, target), side);
+      }
+      CLEAR_BIT(attacks, target);
+    }
+    CLEAR_BIT(bitboard, source);
+  }
+}
+
+/*
+ * King moves and castling. danger holds the squares attacked by the
+ * opponent, so neither needs a make/unmake check.
+ */
+SIDE_INLINE void add_king_moves(MoveList *mlist, int const side, BB const his_occ, BB const danger) {
+  int const king = BY_SIDE(side, K, k);
+  int const home = BY_SIDE(side, e1, e8);
+  BB const occ = pos_occupancies[BOTH];
+
+  // f1, g1 empty and e1, f1, g1 not attacked (f8, g8 and e8, f8, g8 for black)
+  if ((pos_castling & BY_SIDE(side, wk, bk)) &&
+      !(occ & BY_SIDE(side, F1G1, F8G8)) && !(danger & BY_SIDE(side, E1F1G1, E8F8G8))) {
+    add_prio(mlist, ENCODE_CASTLING(king, home, BY_SIDE(side, g1, g8)));
+  }
+  // d1, c1, b1 empty and e1, d1, c1 not attacked (d8, c8, b8 and e8, d8, c8 for black)
+  if ((pos_castling & BY_SIDE(side, wq, bq)) &&
+      !(occ & BY_SIDE(side, D1C1B1, D8C8B8)) && !(danger & BY_SIDE(side, E1D1C1, E8D8C8))) {
+    add_prio(mlist, ENCODE_CASTLING(king, home, BY_SIDE(side, c1, c8)));
+  }
+
+  int const source = FIRST_SET_BIT(pos_pieces[king]);
+  BB attacks = get_king_attacks(source) & ~pos_occupancies[side] & ~danger; // king can only step on safe squares
+  while (attacks) { // loop over target squares
+    int const target = FIRST_SET_BIT(attacks);
+
+    if (IS_SET(his_occ, target)) {
+      add_prio(mlist, ENCODE_SIMPLE_CAPTURE(king, source, target));
+    } else {
+      add_prio(mlist, ENCODE_SIMPLE_MOVE(king, source, target));
+    }
+    CLEAR_BIT(attacks, target);
+  }
+}
+
+/*
+ * Generates all legal moves of side, which must be a constant.
+ */
+SIDE_INLINE void generate_side(MoveList *const glist, int const side) {
+  BB const his_occ = pos_occupancies[!side];
+  BB const my_king = pos_pieces[BY_SIDE(side, K, k)];
+
+  // squares attacked by the opponent, seen through our own king (so that
+  // the king can't step back along a checking ray). Used for king moves
+  // and castling, which therefore need no make/unmake check.
+  BB const danger = compute_attacks_with_occupancy(!side, pos_occupancies[BOTH] & ~my_king);
+
+  add_pawn_moves(glist, side, his_occ);
+  add_piece_moves(glist, side, N, his_occ);
+  add_piece_moves(glist, side, B, his_occ);
+  add_piece_moves(glist, side, R, his_occ);
+  add_piece_moves(glist, side, Q, his_occ);
+  add_king_moves(glist, side, his_occ, danger);
+}
+
 //MVV - LVA
 static void sort_caps(MoveList *mlist) {
 
@@ -109,265 +320,485 @@ static void sort_caps(MoveList *mlist) {
 
 MoveList generate_moves(void) {
   MoveList glist;
-  glist.current_index = 0;
-  glist.capture_count = 0;
+  generate_moves_into(&glist);
+  return glist;
+}
+
+/*
+ * Writes all legal moves straight into the caller's list,
+ * captures and promotions first.
+ */
+void generate_moves_into(MoveList *const glist) {
+  glist->current_index = 0;
+  glist->capture_count = 0;
+  if (check_flags)
+    init_check_info();
   nextCapIndex = 0;
-  int source, target;
-  BB bitboard, attacks;
-  int const min = pos_side ? p : P;
-  int const max = min + 5;
-  BB const my_neg_occ = ~pos_occupancies[pos_side]; //my negative occupancy
-  BB const his_occ = pos_occupancies[!pos_side];
-
-  for (int piece = min; piece <= max; piece++) {
-
-    bitboard = pos_pieces[piece];
-
-    switch (piece) {
-
-      case P:
-        while (bitboard) {
-          source = FIRST_SET_BIT(bitboard);
-          CLEAR_BIT(bitboard, source);
-          target = source - 8; 
-
-          if (!(IS_SET(pos_occupancies[BOTH], target))) { // target not occupied
-            if (source < a6) { // promotion
-              add_move(&glist, ENCODE_PROM(P, source, target, Q));
-              add_move(&glist, ENCODE_PROM(P, source, target, R));
-              add_move(&glist, ENCODE_PROM(P, source, target, B));
-              add_move(&glist, ENCODE_PROM(P, source, target, N));
-            } else { 
-              add_move(&glist, ENCODE_SIMPLE_MOVE(P, source, target)); // normal move
-              if (source > h3 && !(IS_SET(pos_occupancies[BOTH], (target - 8)))) { // double push
-                add_move(&glist, ENCODE_DOUBLE(P, source, (target - 8)));
-              }
-            }
-          }
-
-          // captures
-          attacks = get_pawn_attacks(source,pos_side);
-
-          if ((pos_ep != none) && (attacks & (1ULL << pos_ep))) { // en passant
-            add_move(&glist, ENCODE_EP(P, source, pos_ep));
-            CLEAR_BIT(attacks, pos_ep);
-          }
-
-          attacks &= his_occ;
-
-          while (attacks) {
-            target = FIRST_SET_BIT(attacks);
-            if (source < a6) { // capture and promotion
-              add_move(&glist, ENCODE_CAP_PROM(P, source, target, Q));
-              add_move(&glist, ENCODE_CAP_PROM(P, source, target, R));
-              add_move(&glist, ENCODE_CAP_PROM(P, source, target, B));
-              add_move(&glist, ENCODE_CAP_PROM(P, source, target, N));
-            } else {
-              add_move(&glist, ENCODE_SIMPLE_CAPTURE(P, source, target));
-            }
-            CLEAR_BIT(attacks, target);
-          }
-        }
-        break;
-
-      case N:
-      case n:
-        while (bitboard) {
-          source = FIRST_SET_BIT(bitboard);
-          attacks = get_knight_attacks(source) & my_neg_occ; // don't capture own pieces
-
-          while (attacks) { // loop over target squares
-            target = FIRST_SET_BIT(attacks);
-
-            if (IS_SET(his_occ, target)) {
-              add_move(&glist, ENCODE_SIMPLE_CAPTURE(piece, source, target));
-            } else {
-              add_move(&glist, ENCODE_SIMPLE_MOVE(piece, source, target));
-            }
-            CLEAR_BIT(attacks, target);
-          }
-          CLEAR_BIT(bitboard, source);
-        }
-        break;
-
-      case B:
-      case b:
-        while (bitboard) {
-          source = FIRST_SET_BIT(bitboard);
-          attacks = get_bishop_attacks(source, pos_occupancies[BOTH]) & my_neg_occ;
-          while (attacks) { // loop over target squares
-            target = FIRST_SET_BIT(attacks);
-
-            if (IS_SET(his_occ, target)) {
-              add_move(&glist, ENCODE_SIMPLE_CAPTURE(piece, source, target));
-            } else {
-              add_move(&glist, ENCODE_SIMPLE_MOVE(piece, source, target));
-            }
-            CLEAR_BIT(attacks, target);
-          }
-          CLEAR_BIT(bitboard, source);
-        }
-        break;
-
-      case R:
-      case r:
-        while (bitboard) {
-          source = FIRST_SET_BIT(bitboard);
-
-          attacks = get_rook_attacks(source, pos_occupancies[BOTH]) & my_neg_occ;
-          while (attacks) { // loop over target squares
-            target = FIRST_SET_BIT(attacks);
-
-            if (IS_SET(his_occ, target)) {
-              add_move(&glist, ENCODE_SIMPLE_CAPTURE(piece, source, target));
-            } else {
-              add_move(&glist, ENCODE_SIMPLE_MOVE(piece, source, target));
-            }
-            CLEAR_BIT(attacks, target);
-          }
-          CLEAR_BIT(bitboard, source);
-        }
-        break;
-
-      case Q:
-      case q:
-        while (bitboard) {
-          source = FIRST_SET_BIT(bitboard);
-          attacks = get_queen_attacks(source, pos_occupancies[BOTH]) & my_neg_occ;
-          while (attacks) { // loop over target squares
-            target = FIRST_SET_BIT(attacks);
-
-            if (IS_SET(his_occ, target)) {
-              add_move(&glist, ENCODE_SIMPLE_CAPTURE(piece, source, target));
-            } else {
-              add_move(&glist, ENCODE_SIMPLE_MOVE(piece, source, target));
-            }
-            CLEAR_BIT(attacks, target);
-          }
-          CLEAR_BIT(bitboard, source);
-        }
-        break;
-
-
-      case K:
-        if (pos_castling & wk) {
-          if (!(pos_occupancies[BOTH] & F1G1)) { // f1 and g1 are not occupied
-                                                 // make sure e1 and f1 are not under attack
-            if (!is_square_attacked(e1, BLACK) &&
-                !is_square_attacked(f1, BLACK)) {
-              add_move(&glist, ENCODE_CASTLING(K, e1, g1));
-            }
-          }
-        }
-        if (pos_castling & wq) {
-          if (!(pos_occupancies[BOTH] & D1C1B1)) { // d1,c1 and b1 are not
-                                                   // occupied
-                                                   // make sure e1 and d1 are not under attack
-            if (!is_square_attacked(e1, BLACK) &&
-                !is_square_attacked(d1, BLACK)) {
-              add_move(&glist, ENCODE_CASTLING(K, e1, c1));
-            }
-          }
-        }
-
-        source = FIRST_SET_BIT(bitboard);
-        attacks = get_king_attacks(source) & (~pos_occupancies[WHITE]);
-        while (attacks) { // loop over target squares
-          target = FIRST_SET_BIT(attacks);
-
-          if (IS_SET(pos_occupancies[BLACK], target)) {
-            add_move(&glist, ENCODE_SIMPLE_CAPTURE(K, source, target));
-          } else {
-            add_move(&glist, ENCODE_SIMPLE_MOVE(K, source, target));
-          }
-          CLEAR_BIT(attacks, target);
-        }
-        break;
-
-      case p:
-        while (bitboard) {
-          source = FIRST_SET_BIT(bitboard);
-          CLEAR_BIT(bitboard, source);
-          target = source + 8;
-
-          if (!(IS_SET(pos_occupancies[BOTH], target))) { // target not occupied
-            if (source > h3) { // promotion
-              add_move(&glist, ENCODE_PROM(p, source, target, q));
-              add_move(&glist, ENCODE_PROM(p, source, target, r));
-              add_move(&glist, ENCODE_PROM(p, source, target, b));
-              add_move(&glist, ENCODE_PROM(p, source, target, n));
-            } else {
-              add_move(&glist, ENCODE_SIMPLE_MOVE(p, source, target)); // normal move
-              if (source < a6 && !(IS_SET(pos_occupancies[BOTH], (target + 8)))) { // double push
-                add_move(&glist, ENCODE_DOUBLE(p, source, (target + 8)));
-              }
-            }
-          }
-
-          // captures
-          attacks = get_pawn_attacks(source, pos_side);
-
-          if ((pos_ep != none) && (attacks & (1ULL << pos_ep))) { // en passant
-            add_move(&glist, ENCODE_EP(p, source, pos_ep));
-            CLEAR_BIT(attacks, pos_ep);
-          }
-
-          attacks &= pos_occupancies[WHITE];
-
-          while (attacks) {
-            target = FIRST_SET_BIT(attacks);
-            if (source > h3) { // capture and promotion
-              add_move(&glist, ENCODE_CAP_PROM(p, source, target, q));
-              add_move(&glist, ENCODE_CAP_PROM(p, source, target, r));
-              add_move(&glist, ENCODE_CAP_PROM(p, source, target, b));
-              add_move(&glist, ENCODE_CAP_PROM(p, source, target, n));
-            } else { // simple capture
-              add_move(&glist, ENCODE_SIMPLE_CAPTURE(p, source, target));
-            }
-
-            CLEAR_BIT(attacks, target);
-          }
-        }
-        break;
-      
-      case k:
-        if (pos_castling & bk) {
-          if (!(pos_occupancies[BOTH] & F8G8)) { // f8 and g8 are not occupied
-                                                 // make sure e8 and f8 are not under attack
-            if (!is_square_attacked(e8, WHITE) &&
-                !is_square_attacked(f8, WHITE)) {
-              add_move(&glist, ENCODE_CASTLING(k, e8, g8));
-            }
-          }
-        }
-        if (pos_castling & bq) {
-          if (!(pos_occupancies[BOTH] & D8C8B8)) { // d8,c8 and b8 are not
-                                                   // occupied
-                                                   // make sure e8 and d8 are not under attack
-            if (!is_square_attacked(e8, WHITE) &&
-                !is_square_attacked(d8, WHITE)) {
-              add_move(&glist, ENCODE_CASTLING(k, e8, c8));
-            }
-          }
-        }
-
-        source = FIRST_SET_BIT(bitboard);
-        attacks = get_king_attacks(source) & (~pos_occupancies[BLACK]);
-        while (attacks) { // loop over target squares
-          target = FIRST_SET_BIT(attacks);
-
-          if (IS_SET(pos_occupancies[WHITE], target)) {
-            add_move(&glist, ENCODE_SIMPLE_CAPTURE(k, source, target));
-          } else {
-            add_move(&glist, ENCODE_SIMPLE_MOVE(k, source, target));
-          }
-          CLEAR_BIT(attacks, target);
-        }
-        break;
+
+  if (pos_side == WHITE)
+    generate_side(glist, WHITE);
+  else
+    generate_side(glist, BLACK);
+
+  sort_caps(glist);
+}
+
+/*
+ * Counts the pawn moves of the given pawns whose target square is
+ * in mask. Promotions count as 4 moves. En passant is not included.
+ */
+static int count_pawn_moves(int const side, BB const pawns, BB const mask) {
+  BB const empty = ~pos_occupancies[BOTH];
+  BB const his_occ = pos_occupancies[!side];
+  BB const single = PAWN_PUSH(side, pawns) & empty & mask;
+  BB const double_push = PAWN_PUSH(side, PAWN_PUSH(side, pawns) & empty & DOUBLE_PUSH_RANK(side)) & empty;
+  BB const left = PAWN_WEST(side, pawns) & his_occ & mask;
+  BB const right = PAWN_EAST(side, pawns) & his_occ & mask;
+
+  return POPCNT(single) + POPCNT(double_push & mask) + POPCNT(left) + POPCNT(right)
+    + 3 * (POPCNT(single & PROMOTION_RANKS) + POPCNT(left & PROMOTION_RANKS) + POPCNT(right & PROMOTION_RANKS));
+}
+
+/*
+ * En passant removes two pawns from the same rank, so it is verified
+ * by recomputing the slider attacks on the king with the occupancy
+ * after the capture. A knight or pawn giving check can only be
+ * answered by ep if it is the captured pawn itself.
+ */
+static bool is_ep_legal(int const source, int const king_sq, BB const checkers) {
+  int const them = pos_side == WHITE ? p : P;
+  int const captured = pos_side == WHITE ? pos_ep + 8 : pos_ep - 8;
+  BB const occ = (pos_occupancies[BOTH] ^ (1ULL << source) ^ (1ULL << captured)) | (1ULL << pos_ep);
+
+  if (checkers & (pos_pieces[them + N] | pos_pieces[them + P]) & ~(1ULL << captured))
+    return false;
+
+  return !(get_bishop_attacks(king_sq, occ) & (pos_pieces[them + B] | pos_pieces[them + Q])) &&
+         !(get_rook_attacks(king_sq, occ) & (pos_pieces[them + R] | pos_pieces[them + Q]));
+}
+
+/*
+ * @returns Bitboard of the enemy pieces giving check to side's king
+ */
+static BB find_checkers(int const side, int const king_sq) {
+  int const them = side == WHITE ? p : P;
+  BB const occ = pos_occupancies[BOTH];
+
+  return (get_pawn_attacks(king_sq, side) & pos_pieces[them + P]) |
+         (get_knight_attacks(king_sq) & pos_pieces[them + N]) |
+         (get_bishop_attacks(king_sq, occ) & (pos_pieces[them + B] | pos_pieces[them + Q])) |
+         (get_rook_attacks(king_sq, occ) & (pos_pieces[them + R] | pos_pieces[them + Q]));
+}
+
+/*
+ * Pieces of blocker_side that stand alone between the king on king_sq
+ * and a slider of slider_side. With the king's own side as slider_side
+ * these are pinned pieces, with the other side they are candidates for
+ * a discovered check.
+ */
+static BB find_blockers(int const king_sq, int const slider_side, int const blocker_side) {
+  int const offset = slider_side == WHITE ? P : p;
+  BB const occ = pos_occupancies[BOTH];
+  BB blockers = 0ULL;
+  BB snipers = (get_bishop_attacks(king_sq, pos_occupancies[!blocker_side]) & (pos_pieces[offset + B] | pos_pieces[offset + Q])) |
+               (get_rook_attacks(king_sq, pos_occupancies[!blocker_side]) & (pos_pieces[offset + R] | pos_pieces[offset + Q]));
+
+  while (snipers) {
+    int const sniper = FIRST_SET_BIT(snipers);
+    BB const between = get_between(king_sq, sniper) & occ;
+    if (!(between & (between - 1)))
+      blockers |= between & pos_occupancies[blocker_side];
+    CLEAR_BIT(snipers, sniper);
+  }
+  return blockers;
+}
+
+/*
+ * Counts legal moves without generating them: legal target masks are
+ * computed per piece, restricted by checks and pins, and popcounted.
+ */
+int count_legal_moves(void) {
+  int const us = pos_side;
+  int const mine = us == WHITE ? P : p;
+  BB const occ = pos_occupancies[BOTH];
+  BB const my_occ = pos_occupancies[us];
+  BB const my_king = pos_pieces[mine + K];
+  int const king_sq = FIRST_SET_BIT(my_king);
+  BB const danger = compute_attacks_with_occupancy(!us, occ & ~my_king);
+
+  int count = POPCNT(get_king_attacks(king_sq) & ~my_occ & ~danger);
+
+  BB const checkers = find_checkers(us, king_sq);
+
+  if (checkers & (checkers - 1)) // double check, only the king can move
+    return count;
+
+  BB mask = ~my_occ;
+  if (checkers) {
+    mask = get_between(king_sq, FIRST_SET_BIT(checkers)) | checkers;
+  } else if (us == WHITE) {
+    count += (pos_castling & wk) && !(occ & F1G1) && !(danger & E1F1G1);
+    count += (pos_castling & wq) && !(occ & D1C1B1) && !(danger & E1D1C1);
+  } else {
+    count += (pos_castling & bk) && !(occ & F8G8) && !(danger & E8F8G8);
+    count += (pos_castling & bq) && !(occ & D8C8B8) && !(danger & E8D8C8);
+  }
+
+  BB const pinned = find_blockers(king_sq, !us, us);
+
+  BB bitboard = pos_pieces[mine + N] & ~pinned; // pinned knights can never move
+  while (bitboard) {
+    int const source = FIRST_SET_BIT(bitboard);
+    count += POPCNT(get_knight_attacks(source) & mask);
+    CLEAR_BIT(bitboard, source);
+  }
+
+  bitboard = pos_pieces[mine + B] | pos_pieces[mine + Q];
+  while (bitboard) {
+    int const source = FIRST_SET_BIT(bitboard);
+    BB attacks = get_bishop_attacks(source, occ) & mask;
+    if (IS_SET(pinned, source))
+      attacks &= get_line(king_sq, source);
+    count += POPCNT(attacks);
+    CLEAR_BIT(bitboard, source);
+  }
+
+  bitboard = pos_pieces[mine + R] | pos_pieces[mine + Q];
+  while (bitboard) {
+    int const source = FIRST_SET_BIT(bitboard);
+    BB attacks = get_rook_attacks(source, occ) & mask;
+    if (IS_SET(pinned, source))
+      attacks &= get_line(king_sq, source);
+    count += POPCNT(attacks);
+    CLEAR_BIT(bitboard, source);
+  }
+
+  BB const pawns = pos_pieces[mine + P];
+  count += count_pawn_moves(us, pawns & ~pinned, mask);
+  bitboard = pawns & pinned;
+  while (bitboard) {
+    int const source = FIRST_SET_BIT(bitboard);
+    count += count_pawn_moves(us, 1ULL << source, mask & get_line(king_sq, source));
+    CLEAR_BIT(bitboard, source);
+  }
+
+  if (pos_ep != none) {
+    bitboard = get_pawn_attacks(pos_ep, !us) & pawns;
+    while (bitboard) {
+      int const source = FIRST_SET_BIT(bitboard);
+      count += is_ep_legal(source, king_sq, checkers);
+      CLEAR_BIT(bitboard, source);
     }
   }
 
+  return count;
+}
 
-  sort_caps(&glist);
-  return glist;
+/*
+ * Returns at the first legal move found. Pieces are tried from the
+ * cheapest to verify: king, knights, pawns, then sliders. Castling
+ * never needs to be looked at: if it is legal, so is the king's step
+ * to the f- or d-file.
+ */
+bool has_legal_move(void) {
+  int const us = pos_side;
+  int const mine = us == WHITE ? P : p;
+  BB const occ = pos_occupancies[BOTH];
+  BB const my_occ = pos_occupancies[us];
+  BB const my_king = pos_pieces[mine + K];
+  int const king_sq = FIRST_SET_BIT(my_king);
+  BB const king_targets = get_king_attacks(king_sq) & ~my_occ;
+
+  if (king_targets) {
+    BB const danger = compute_attacks_with_occupancy(!us, occ & ~my_king);
+    if (king_targets & ~danger)
+      return true;
+  }
+
+  BB const checkers = find_checkers(us, king_sq);
+  if (checkers & (checkers - 1)) // double check, only the king can move
+    return false;
+
+  BB const mask = checkers ? get_between(king_sq, FIRST_SET_BIT(checkers)) | checkers : ~my_occ;
+  BB const pinned = find_blockers(king_sq, !us, us);
+
+  BB bitboard = pos_pieces[mine + N] & ~pinned;
+  while (bitboard) {
+    int const source = FIRST_SET_BIT(bitboard);
+    if (get_knight_attacks(source) & mask)
+      return true;
+    CLEAR_BIT(bitboard, source);
+  }
+
+  BB const pawns = pos_pieces[mine + P];
+  if (count_pawn_moves(us, pawns & ~pinned, mask))
+    return true;
+
+  bitboard = pos_pieces[mine + B] | pos_pieces[mine + Q];
+  while (bitboard) {
+    int const source = FIRST_SET_BIT(bitboard);
+    BB attacks = get_bishop_attacks(source, occ) & mask;
+    if (IS_SET(pinned, source))
+      attacks &= get_line(king_sq, source);
+    if (attacks)
+      return true;
+    CLEAR_BIT(bitboard, source);
+  }
+
+  bitboard = pos_pieces[mine + R] | pos_pieces[mine + Q];
+  while (bitboard) {
+    int const source = FIRST_SET_BIT(bitboard);
+    BB attacks = get_rook_attacks(source, occ) & mask;
+    if (IS_SET(pinned, source))
+      attacks &= get_line(king_sq, source);
+    if (attacks)
+      return true;
+    CLEAR_BIT(bitboard, source);
+  }
+
+  bitboard = pawns & pinned;
+  while (bitboard) {
+    int const source = FIRST_SET_BIT(bitboard);
+    if (count_pawn_moves(us, 1ULL << source, mask & get_line(king_sq, source)))
+      return true;
+    CLEAR_BIT(bitboard, source);
+  }
+
+  if (pos_ep != none) {
+    bitboard = get_pawn_attacks(pos_ep, !us) & pawns;
+    while (bitboard) {
+      int const source = FIRST_SET_BIT(bitboard);
+      if (is_ep_legal(source, king_sq, checkers))
+        return true;
+      CLEAR_BIT(bitboard, source);
+    }
+  }
+
+  return false;
+}
+
+bool is_checkmate(void) {
+  return IS_KING_IN_CHECK(pos_side) && !has_legal_move();
+}
+
+bool is_stalemate(void) {
+  return !IS_KING_IN_CHECK(pos_side) && !has_legal_move();
+}
+
+/*
+ * Gives-check detection without making the move. For the side to
+ * move, check_squares[piece] holds the squares from which a piece
+ * of that type would attack the enemy king, and check_discoverers
+ * the pieces whose departure uncovers an attack by one of our
+ * sliders.
+ */
+static void init_check_info(void) {
+  int const us = pos_side;
+  BB const occ = pos_occupancies[BOTH];
+
+  check_king_sq = FIRST_SET_BIT(pos_pieces[us == WHITE ? k : K]);
+  check_squares[P] = get_pawn_attacks(check_king_sq, !us);
+  check_squares[N] = get_knight_attacks(check_king_sq);
+  check_squares[B] = get_bishop_attacks(check_king_sq, occ);
+  check_squares[R] = get_rook_attacks(check_king_sq, occ);
+  check_squares[Q] = check_squares[B] | check_squares[R];
+  check_squares[K] = 0ULL;
+  check_discoverers = find_blockers(check_king_sq, us, us);
+}
+
+/*
+ * Requires init_check_info() for the current position.
+ * In a legal position a slider's departure can't open a line from its
+ * own target square to the king, so the check squares computed with
+ * the current occupancy are exact for direct checks.
+ */
+static bool move_gives_check(MOVE const move) {
+  if (GET_MOVE_PROMOTION(move) || GET_MOVE_EP(move) || GET_MOVE_CASTLING(move))
+    return special_move_gives_check(move);
+
+  int const source = GET_MOVE_SOURCE(move);
+  int const target = GET_MOVE_TARGET(move);
+
+  if (IS_SET(check_squares[GET_MOVE_PIECE(move) % 6], target))
+    return true;
+
+  return IS_SET(check_discoverers, source) && !(IS_SET(get_line(check_king_sq, source), target));
+}
+
+/*
+ * Promotions, en passant and castling change the board in more than
+ * two squares, so the attacks on the king are recomputed from the
+ * resulting occupancy.
+ */
+static bool special_move_gives_check(MOVE const move) {
+  int const us = pos_side;
+  int const mine = us == WHITE ? P : p;
+  int const source = GET_MOVE_SOURCE(move);
+  int const target = GET_MOVE_TARGET(move);
+  int const prom_piece = GET_MOVE_PROMOTION(move);
+  BB const target_bb = 1ULL << target;
+  BB const king = 1ULL << check_king_sq;
+  BB occ = (pos_occupancies[BOTH] & ~(1ULL << source)) | target_bb;
+  BB diagonal = pos_pieces[mine + B] | pos_pieces[mine + Q];
+  BB orthogonal = pos_pieces[mine + R] | pos_pieces[mine + Q];
+
+  if (GET_MOVE_CASTLING(move)) {
+    int const rook_from = target > source ? target + 1 : target - 2;
+    int const rook_to = target > source ? target - 1 : target + 1;
+    BB const rook_move = (1ULL << rook_from) | (1ULL << rook_to);
+    occ ^= rook_move;
+    orthogonal ^= rook_move;
+  } else if (GET_MOVE_EP(move)) {
+    occ &= ~(1ULL << (us == WHITE ? target + 8 : target - 8));
+    if (get_pawn_attacks(target, us) & king)
+      return true;
+  } else { // promotion
+    int const promoted = prom_piece % 6;
+    if (promoted == N && (get_knight_attacks(target) & king))
+      return true;
+    if (promoted == B || promoted == Q)
+      diagonal |= target_bb;
+    if (promoted == R || promoted == Q)
+      orthogonal |= target_bb;
+  }
+
+  return (get_bishop_attacks(check_king_sq, occ) & diagonal) ||
+         (get_rook_attacks(check_king_sq, occ) & orthogonal);
+}
+
+void set_check_flags(bool const enabled) {
+  check_flags = enabled;
+}
+
+bool gives_check(MOVE const move) {
+  init_check_info();
+  return move_gives_check(move);
+}
+
+/*
+ * Accepts exactly the moves the generator could produce for the side
+ * to move, apart from leaving the king in check or castling through
+ * an attacked square: the flags have to agree with the board, so that
+ * make_move() can be trusted with the move. The check flag is ignored.
+ */
+bool is_pseudo_legal(MOVE const move) {
+  int const us = pos_side;
+  int const mine = us == WHITE ? P : p;
+  int const piece = GET_MOVE_PIECE(move);
+  int const source = GET_MOVE_SOURCE(move);
+  int const target = GET_MOVE_TARGET(move);
+  int const promotion = GET_MOVE_PROMOTION(move);
+  BB const target_bb = 1ULL << target;
+  BB const occ = pos_occupancies[BOTH];
+
+  if ((move & ~0x1FFFFFFu) || piece < mine || piece > mine + K || pos_occupancy[source] != piece ||
+      (target_bb & (pos_occupancies[us] | pos_pieces[us == WHITE ? k : K])))
+    return false;
+
+  // the only encoding the generator uses for this piece, source and target
+  bool const pawn = piece == mine;
+  bool const ep = pawn && target == pos_ep;
+  bool const capture = ep || (target_bb & occ);
+  bool const double_push = pawn && (target == source + 16 || target == source - 16);
+  bool const castling = piece == mine + K && (target == source + 2 || target == source - 2);
+  if ((move & ~0x1000000u) != (MOVE) (ENCODE_MOVE(piece, source, target, promotion, capture, double_push, ep, castling)))
+    return false;
+
+  if (pawn) {
+    if (target_bb & PROMOTION_RANKS ? promotion < mine + N || promotion > mine + Q : promotion != 0)
+      return false;
+    if (capture)
+      return get_pawn_attacks(source, us) & target_bb;
+    BB const single = PAWN_PUSH(us, 1ULL << source) & ~occ;
+    if (double_push)
+      return (single & DOUBLE_PUSH_RANK(us)) && (PAWN_PUSH(us, single) & ~occ & target_bb);
+    return single & target_bb;
+  }
+  if (promotion)
+    return false;
+
+  switch (piece % 6) {
+    case N:
+      return get_knight_attacks(source) & target_bb;
+    case B:
+      return get_bishop_attacks(source, occ) & target_bb;
+    case R:
+      return get_rook_attacks(source, occ) & target_bb;
+    case Q:
+      return get_queen_attacks(source, occ) & target_bb;
+  }
+  if (!castling)
+    return get_king_attacks(source) & target_bb;
+  if (source != BY_SIDE(us, e1, e8))
+    return false;
+  if (target == source + 2)
+    return (pos_castling & BY_SIDE(us, wk, bk)) && !(occ & BY_SIDE(us, F1G1, F8G8));
+  return (pos_castling & BY_SIDE(us, wq, bq)) && !(occ & BY_SIDE(us, D1C1B1, D8C8B8));
+}
+
+/*
+ * The attackers of the king are found on the occupancy after the
+ * move, without making it.
+ */
+bool is_legal(MOVE const move) {
+  if (!is_pseudo_legal(move))
+    return false;
+
+  int const us = pos_side;
+  int const source = GET_MOVE_SOURCE(move);
+  int const target = GET_MOVE_TARGET(move);
+
+  if (GET_MOVE_CASTLING(move)) {
+    BB path = target > source ? BY_SIDE(us, E1F1G1, E8F8G8) : BY_SIDE(us, E1D1C1, E8D8C8);
+    for (; path; path &= path - 1)
+      if (is_square_attacked(FIRST_SET_BIT(path), !us))
+        return false;
+    return true;
+  }
+
+  BB captured = 1ULL << target;
+  BB occ = (pos_occupancies[BOTH] & ~(1ULL << source)) | captured;
+  if (GET_MOVE_EP(move)) {
+    captured = 1ULL << (us == WHITE ? target + 8 : target - 8);
+    occ &= ~captured;
+  }
+  int const king_sq = GET_MOVE_PIECE(move) % 6 == K ? target : FIRST_SET_BIT(pos_pieces[us == WHITE ? K : k]);
+  return !(attackers_to(king_sq, occ) & pos_occupancies[!us] & ~captured);
+}
+
+static BB count_nodes(int const depth) {
+  MoveList *const move_list = &perft_stack[depth];
+  BB nodes = 0;
+
+  generate_moves_into(move_list);
+  if (depth == 1) // bulk counting, the leaves don't need to be made
+    return move_list->current_index;
+
+  for (int i = 0; i < move_list->current_index && !perft_stopped; i++) {
+    make_move(move_list->moves[i]);
+    nodes += count_nodes(depth - 1);
+    takeback();
+  }
+  return nodes;
+}
+
+/*
+ * Counts the leaves of the legal move tree of the given depth below
+ * the current position. The move lists are per thread like the board.
+ * @returns The number of leaves, 0 if depth is outside
+ *          [0, MAX_PERFT_DEPTH]; incomplete after perft_stop()
+ */
+BB perft(int const depth) {
+  if (depth < 0 || depth > MAX_PERFT_DEPTH)
+    return 0;
+
+  perft_stopped = false;
+  return depth ? count_nodes(depth) : 1;
+}
+
+/*
+ * Makes running perft() calls return early, on any thread.
+ */
+void perft_stop(void) {
+  perft_stopped = true;
 }
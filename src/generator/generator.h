@@ -1,6 +1,20 @@
 #ifndef SPARK_GENERATOR_H
 #define SPARK_GENERATOR_H
+#include <stdbool.h>
+
+#define MAX_PERFT_DEPTH 64
 
 MoveList generate_moves(void);
+void generate_moves_into(MoveList *out);
+int count_legal_moves(void);
+bool has_legal_move(void);
+bool is_checkmate(void);
+bool is_stalemate(void);
+void set_check_flags(bool enabled);
+bool gives_check(MOVE move);
+bool is_pseudo_legal(MOVE move);
+bool is_legal(MOVE move);
+BB perft(int depth);
+void perft_stop(void);
 extern MoveList list;
 #endif
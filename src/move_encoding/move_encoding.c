@@ -1,5 +1,7 @@
 #include <stdio.h>
+#include <limits.h>
 #include "../board/board.h"
+#include "../generator/generator.h"
 #include "move_encoding.h"
 #include <string.h>
 
@@ -7,18 +9,86 @@ void print_move_UCI(MOVE const move) {
     printf("%s\n", get_move_UCI(move));
 }
 
+/*
+ * The result lives in a per-thread static buffer that is
+ * overwritten by the next call. Prefer move_to_uci().
+ */
 char *get_move_UCI(MOVE const move) {
-    static char str[6];
-    str[0] = '\0';
-    strcat(str, square_to_coordinates[GET_MOVE_SOURCE(move)]);
-    strcat(str, square_to_coordinates[GET_MOVE_TARGET(move)]);
+    static _Thread_local char str[6];
+    move_to_uci(move, str);
+    return str;
+}
+
+int move_to_uci(MOVE const move, char out[6]) {
+    int const source = GET_MOVE_SOURCE(move);
+    int const target = GET_MOVE_TARGET(move);
+
+    out[0] = 'a' + source % 8;
+    out[1] = '8' - source / 8;
+    out[2] = 'a' + target % 8;
+    out[3] = '8' - target / 8;
     if (GET_MOVE_PROMOTION(move)) {
-        str[4] = promoted_pieces[GET_MOVE_PROMOTION(move)];
-        str[5] = '\0';
-    } else {
-        str[4] = '\0';
+        out[4] = promoted_pieces[GET_MOVE_PROMOTION(move)];
+        out[5] = '\0';
+        return 5;
     }
-    return str;
+    out[4] = '\0';
+    return 4;
+}
+
+/*
+ * Writes the moves separated by single spaces. Only whole moves
+ * are written: the output is cut short if it doesn't fit in size.
+ */
+size_t move_list_to_uci(MoveList const *move_list, char *out, size_t const size) {
+    size_t len = 0;
+
+    if (size == 0)
+        return 0;
+
+    for (int i = 0; i < move_list->current_index; i++) {
+        char uci[6];
+        int const move_len = move_to_uci(move_list->moves[i], uci);
+        size_t const needed = move_len + (i > 0);
+
+        if (len + needed >= size)
+            break;
+        if (i > 0)
+            out[len++] = ' ';
+        memcpy(out + len, uci, move_len);
+        len += move_len;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+/*
+ * Returns the legal move of the current position matching the
+ * UCI string, or 0 if the string is malformed or the move illegal.
+ * The check flag is never set.
+ */
+MOVE parse_uci_move(char const *uci) {
+    if (uci[0] < 'a' || uci[0] > 'h' || uci[1] < '1' || uci[1] > '8' ||
+        uci[2] < 'a' || uci[2] > 'h' || uci[3] < '1' || uci[3] > '8')
+        return 0;
+
+    unsigned const source = (uci[0] - 'a') + ('8' - uci[1]) * 8;
+    unsigned const target = (uci[2] - 'a') + ('8' - uci[3]) * 8;
+    char const prom = uci[4] && strchr("qrbn", uci[4]) ? uci[4] : '\0';
+    int const piece = pos_occupancy[source];
+    if (piece < P || piece > k)
+        return 0;
+
+    // encoded like the generator would, is_legal() checks the rest
+    bool const pawn = piece == P || piece == p;
+    bool const ep = pawn && target == (unsigned) pos_ep;
+    bool const capture = ep || pos_occupancy[target] != INT_MAX;
+    bool const double_push = pawn && (target == source + 16 || target + 16 == source);
+    bool const castling = (piece == K || piece == k) && (target == source + 2 || target + 2 == source);
+    int const promoted = prom ? char_pieces[pos_side == WHITE ? prom - 'a' + 'A' : prom] : 0;
+    MOVE const move = ENCODE_MOVE(piece, source, target, promoted, capture, double_push, ep, castling);
+
+    return is_legal(move) ? move : 0;
 }
 
 
@@ -43,3 +113,68 @@ void print_move(MOVE const move) {
     printf("Is Check:..........%s\n", GET_MOVE_CHECK(move) ? "true" : "false");
     printf("------------------------\n\n");
 }
+
+/*
+ * Promotion codes store the promoted piece as N, B, R, Q = 0..3,
+ * which is the white piece code minus N.
+ */
+MOVE16 compress_move(MOVE const move) {
+    int const source = GET_MOVE_SOURCE(move);
+    int const target = GET_MOVE_TARGET(move);
+    int const prom_piece = GET_MOVE_PROMOTION(move);
+    int code;
+
+    if (prom_piece) {
+        code = (GET_MOVE_CAPTURE(move) ? MOVE16_CAP_PROM : MOVE16_PROM) + (prom_piece % 6 - N);
+    } else if (GET_MOVE_EP(move)) {
+        code = MOVE16_EP;
+    } else if (GET_MOVE_CAPTURE(move)) {
+        code = MOVE16_CAPTURE;
+    } else if (GET_MOVE_DOUBLE(move)) {
+        code = MOVE16_DOUBLE;
+    } else if (GET_MOVE_CASTLING(move)) {
+        code = target % 8 == 6 ? MOVE16_KING_CASTLE : MOVE16_QUEEN_CASTLE;
+    } else {
+        code = MOVE16_QUIET;
+    }
+
+    return ENCODE_MOVE16(source, target, code);
+}
+
+/*
+ * Restores the full move from the current global position,
+ * which must be the one the move was compressed in.
+ */
+MOVE expand_move(MOVE16 const move) {
+    int const source = GET_MOVE16_SOURCE(move);
+    int const target = GET_MOVE16_TARGET(move);
+    int const code = GET_MOVE16_CODE(move);
+    int const piece = pos_occupancy[source];
+
+    switch (code) {
+        case MOVE16_DOUBLE:
+            return ENCODE_DOUBLE(piece, source, target);
+        case MOVE16_KING_CASTLE:
+        case MOVE16_QUEEN_CASTLE:
+            return ENCODE_CASTLING(piece, source, target);
+        case MOVE16_CAPTURE:
+            return ENCODE_SIMPLE_CAPTURE(piece, source, target);
+        case MOVE16_EP:
+            return ENCODE_EP(piece, source, target);
+        case MOVE16_QUIET:
+            return ENCODE_SIMPLE_MOVE(piece, source, target);
+    }
+
+    int const prom_piece = piece + N + (code & 3); // piece is P or p
+    if (code & 4)
+        return ENCODE_CAP_PROM(piece, source, target, prom_piece);
+    return ENCODE_PROM(piece, source, target, prom_piece);
+}
+
+/*
+ * The full move is recorded in the move history,
+ * so takeback() undoes it like any other move.
+ */
+void make_move16(MOVE16 const move) {
+    make_move(expand_move(move));
+}
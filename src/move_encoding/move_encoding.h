@@ -1,6 +1,7 @@
 #ifndef SPARK_MOVE_ENCODING_H
 #define SPARK_MOVE_ENCODING_H
 
+#include <stddef.h>
 #include "../Types.h"
 
 /*
@@ -83,8 +84,52 @@
 
 #define SET_MOVE_CHECK(move)         ((move | 0x1000000))
 
+/*
+	Compact 16-bit move. Piece and captured piece are taken from the
+	board, so a MOVE16 is only meaningful in the position it was made for.
+
+	MSB                 LSB
+	0000 0000 0011 1111   source
+	0000 1111 1100 0000   target
+	1111 0000 0000 0000   special code
+
+	code  0   quiet move            code  8-11  promotion (N, B, R, Q)
+	code  1   double pawn push      code 12-15  capture and promotion
+	code  2   king side castling
+	code  3   queen side castling
+	code  4   capture
+	code  5   en passant capture
+*/
+
+enum {
+	MOVE16_QUIET, MOVE16_DOUBLE, MOVE16_KING_CASTLE, MOVE16_QUEEN_CASTLE,
+	MOVE16_CAPTURE, MOVE16_EP,
+	MOVE16_PROM = 8, MOVE16_CAP_PROM = 12
+};
+
+#define ENCODE_MOVE16(source, target, code) \
+	((MOVE16)((source) | ((target) << 6) | ((code) << 12)))
+
+#define GET_MOVE16_SOURCE(move)      ((move) & 0x3F)
+#define GET_MOVE16_TARGET(move)      (((move) >> 6) & 0x3F)
+#define GET_MOVE16_CODE(move)        (((move) >> 12) & 0xF)
+#define GET_MOVE16_CAPTURE(move)     ((move) & 0x4000)
+#define GET_MOVE16_PROMOTION(move)   ((move) & 0x8000)
+
 char *get_move_UCI(MOVE move);
 
+int move_to_uci(MOVE move, char out[6]);
+
+size_t move_list_to_uci(MoveList const *move_list, char *out, size_t size);
+
+MOVE parse_uci_move(char const *uci);
+
+MOVE16 compress_move(MOVE move);
+
+MOVE expand_move(MOVE16 move);
+
+void make_move16(MOVE16 move);
+
 void print_move_list(MoveList *move_list);
 
 void print_move(MOVE move);
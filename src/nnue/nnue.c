@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../board/board.h"
+#include "../move_encoding/move_encoding.h"
+#include "nnue.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/*
+ * Neural network evaluation (NNUE). The input layer has one feature
+ * per (own king square, piece, square), seen from each side: black's
+ * view is mirrored vertically with the colours swapped, so "own"
+ * pieces are always P..K. Its output, the accumulator, is kept per
+ * ply and updated from the pieces a move adds and removes; only a
+ * king move makes the mover's half be recomputed.
+ *
+ *   accumulator  2 x NNUE_HIDDEN int16, side to move first
+ *   -> clipped ReLU [0, 127] -> NNUE_L1 int16 affine, >> 6
+ *   -> clipped ReLU [0, 127] -> 1 int16 affine, / 16 = centipawns
+ *
+ * The accumulator stack is a ring of NNUE_STACK entries indexed by
+ * pos_moves.index. Each entry records the index it was computed
+ * for, so entries overwritten deeper in the tree or left from
+ * another position are never used. Moves only record the pieces
+ * they change in their entry; when evaluated, an entry is brought
+ * up to date from the nearest computed ancestor by replaying those
+ * changes, unless a refresh is cheaper or the perspective's king
+ * moved on the way.
+ *
+ * Weight file, host byte order:
+ *   "SPKNNUE1", uint32 features, hidden, l1 (must match), then
+ *   int16 ft_biases[hidden], int16 ft_weights[features][hidden],
+ *   int32 l1_biases[l1], int16 l1_weights[l1][2 * hidden],
+ *   int32 out_bias, int16 out_weights[l1]
+ */
+
+#define NNUE_STACK 128 // a power of two
+#define NNUE_MAGIC "SPKNNUE1"
+#define CLIP_MAX 127
+#define L1_SHIFT 6
+#define OUTPUT_SCALE 16
+
+typedef struct Network {
+  int16_t ft_biases[NNUE_HIDDEN];
+  int16_t ft_weights[NNUE_FEATURES][NNUE_HIDDEN];
+  int32_t l1_biases[NNUE_L1];
+  int16_t l1_weights[NNUE_L1][2 * NNUE_HIDDEN];
+  int32_t out_bias;
+  int16_t out_weights[NNUE_L1];
+} Network;
+
+// the pieces one move adds and removes
+typedef struct DirtyPieces {
+  int added[2][2], removed[2][2]; // piece, square
+  int add_count, remove_count;
+  int king_moved; // the side whose king moved, -1 if none
+} DirtyPieces;
+
+typedef struct Accumulator {
+  int16_t values[2][NNUE_HIDDEN] __attribute__((aligned(32)));
+  int valid_for[2]; // per perspective, pos_moves.index + 1 it was computed for, 0 if none
+  int dirty_for; // pos_moves.index + 1 the move below led to, 0 if none
+  DirtyPieces dirty;
+} Accumulator;
+
+bool nnue_enabled = false;
+static Network *network;
+static _Thread_local Accumulator stack[NNUE_STACK];
+
+static int feature(int perspective, int king, int piece, int square);
+static void refresh(int16_t *values, int perspective);
+static void apply(Accumulator *to, Accumulator const *from, int perspective, int king);
+static void update(int index, int perspective);
+static void add_feature(int16_t *values, int index);
+static void remove_feature(int16_t *values, int index);
+static int32_t dot(int16_t const *input, int16_t const *weights);
+static int forward(int16_t const *us, int16_t const *them);
+
+static int feature(int const perspective, int king, int piece, int square) {
+  if (perspective == BLACK) {
+    king ^= 56;
+    square ^= 56;
+    piece = piece < p ? piece + p : piece - p;
+  }
+  return (king * 12 + piece) * 64 + square;
+}
+
+static void add_feature(int16_t *const values, int const index) {
+  int16_t const *const weights = network->ft_weights[index];
+  for (int i = 0; i < NNUE_HIDDEN; i++)
+    values[i] += weights[i];
+}
+
+static void remove_feature(int16_t *const values, int const index) {
+  int16_t const *const weights = network->ft_weights[index];
+  for (int i = 0; i < NNUE_HIDDEN; i++)
+    values[i] -= weights[i];
+}
+
+/*
+ * Computes one side's half of the accumulator from scratch.
+ */
+static void refresh(int16_t *const values, int const perspective) {
+  int const king = FIRST_SET_BIT(pos_pieces[perspective == WHITE ? K : k]);
+
+  memcpy(values, network->ft_biases, sizeof(network->ft_biases));
+  for (int piece = P; piece <= k; piece++) {
+    BB bitboard = pos_pieces[piece];
+    while (bitboard) {
+      add_feature(values, feature(perspective, king, piece, FIRST_SET_BIT(bitboard)));
+      bitboard &= bitboard - 1;
+    }
+  }
+}
+
+/*
+ * Computes one side's half of an entry from its parent, which has
+ * to be computed, by applying the entry's dirty pieces.
+ */
+static void apply(Accumulator *const to, Accumulator const *const from, int const perspective, int const king) {
+  int16_t *const values = to->values[perspective];
+  DirtyPieces const *const dirty = &to->dirty;
+
+  memcpy(values, from->values[perspective], sizeof(to->values[perspective]));
+  for (int i = 0; i < dirty->add_count; i++)
+    add_feature(values, feature(perspective, king, dirty->added[i][0], dirty->added[i][1]));
+  for (int i = 0; i < dirty->remove_count; i++)
+    remove_feature(values, feature(perspective, king, dirty->removed[i][0], dirty->removed[i][1]));
+}
+
+/*
+ * Called by make_move() before the move is pushed. Only the dirty
+ * pieces are recorded, the accumulator is computed when evaluated.
+ */
+void nnue_make_move(MOVE const move, int const captured) {
+  int const index = pos_moves.index;
+  Accumulator *const to = &stack[(index + 1) & (NNUE_STACK - 1)];
+  DirtyPieces *const dirty = &to->dirty;
+
+  int const piece = GET_MOVE_PIECE(move);
+  int const source = GET_MOVE_SOURCE(move);
+  int const target = GET_MOVE_TARGET(move);
+  int const mover = piece < p ? WHITE : BLACK;
+
+  dirty->add_count = dirty->remove_count = 1;
+  dirty->king_moved = piece == K || piece == k ? mover : -1;
+  dirty->removed[0][0] = piece;
+  dirty->removed[0][1] = source;
+  dirty->added[0][0] = GET_MOVE_PROMOTION(move) ? (int) GET_MOVE_PROMOTION(move) : piece;
+  dirty->added[0][1] = target;
+  if (GET_MOVE_CAPTURE(move)) {
+    dirty->removed[1][0] = captured;
+    dirty->removed[1][1] = GET_MOVE_EP(move) ? (mover == WHITE ? target + 8 : target - 8) : target;
+    dirty->remove_count++;
+  }
+  if (GET_MOVE_CASTLING(move)) {
+    int const kingside = target == g1 || target == g8;
+    dirty->removed[1][0] = dirty->added[1][0] = mover == WHITE ? R : r;
+    dirty->removed[1][1] = kingside ? target + 1 : target - 2;
+    dirty->added[1][1] = kingside ? target - 1 : target + 1;
+    dirty->remove_count++;
+    dirty->add_count++;
+  }
+  to->dirty_for = index + 2;
+  to->valid_for[WHITE] = to->valid_for[BLACK] = 0;
+}
+
+/*
+ * Called by make_null_move() before the move is pushed.
+ */
+void nnue_null_move(void) {
+  int const index = pos_moves.index;
+  Accumulator *const to = &stack[(index + 1) & (NNUE_STACK - 1)];
+
+  to->dirty = (DirtyPieces) {.king_moved = -1};
+  to->dirty_for = index + 2;
+  to->valid_for[WHITE] = to->valid_for[BLACK] = 0;
+}
+
+/*
+ * Brings one half of the current entry up to date. Walks back to the
+ * nearest ancestor computed for the perspective and replays the
+ * dirty pieces from there, unless that passes a king move of the
+ * perspective or changes more features than a refresh adds.
+ */
+static void update(int const index, int const perspective) {
+  int const king = FIRST_SET_BIT(pos_pieces[perspective == WHITE ? K : k]);
+  int const budget = POPCNT(pos_occupancies[BOTH]);
+  int cost = 0;
+  int ancestor = index;
+
+  for (;; ancestor--) {
+    Accumulator const *const entry = &stack[ancestor & (NNUE_STACK - 1)];
+    if (entry->valid_for[perspective] == ancestor + 1)
+      break;
+    cost += entry->dirty.add_count + entry->dirty.remove_count;
+    if (entry->dirty_for != ancestor + 1 || entry->dirty.king_moved == perspective || cost > budget) {
+      Accumulator *const current = &stack[index & (NNUE_STACK - 1)];
+      refresh(current->values[perspective], perspective);
+      current->valid_for[perspective] = index + 1;
+      return;
+    }
+  }
+
+  for (int i = ancestor + 1; i <= index; i++) {
+    Accumulator *const entry = &stack[i & (NNUE_STACK - 1)];
+    apply(entry, &stack[(i - 1) & (NNUE_STACK - 1)], perspective, king);
+    entry->valid_for[perspective] = i + 1;
+  }
+}
+
+/*
+ * Forgets the calling thread's accumulators, for a new position.
+ */
+void nnue_invalidate(void) {
+  for (int i = 0; i < NNUE_STACK; i++)
+    stack[i].valid_for[WHITE] = stack[i].valid_for[BLACK] = stack[i].dirty_for = 0;
+}
+
+/*
+ * Dot product of the 2 * NNUE_HIDDEN clipped inputs with one row
+ * of the first layer.
+ */
+static int32_t dot(int16_t const *const input, int16_t const *const weights) {
+#ifdef __AVX2__
+  __m256i sum = _mm256_setzero_si256();
+  for (int i = 0; i < 2 * NNUE_HIDDEN; i += 16)
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_load_si256((__m256i const *) (input + i)),
+                                                  _mm256_loadu_si256((__m256i const *) (weights + i))));
+  __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+  return _mm_cvtsi128_si32(half);
+#else
+  int32_t sum = 0;
+  for (int i = 0; i < 2 * NNUE_HIDDEN; i++)
+    sum += input[i] * weights[i];
+  return sum;
+#endif
+}
+
+static int forward(int16_t const *const us, int16_t const *const them) {
+  int16_t input[2 * NNUE_HIDDEN] __attribute__((aligned(32)));
+
+  for (int i = 0; i < NNUE_HIDDEN; i++) {
+    input[i] = us[i] < 0 ? 0 : us[i] > CLIP_MAX ? CLIP_MAX : us[i];
+    input[NNUE_HIDDEN + i] = them[i] < 0 ? 0 : them[i] > CLIP_MAX ? CLIP_MAX : them[i];
+  }
+
+  int32_t output = network->out_bias;
+  for (int j = 0; j < NNUE_L1; j++) {
+    int32_t const sum = (network->l1_biases[j] + dot(input, network->l1_weights[j])) >> L1_SHIFT;
+    output += (sum < 0 ? 0 : sum > CLIP_MAX ? CLIP_MAX : sum) * network->out_weights[j];
+  }
+  return output / OUTPUT_SCALE;
+}
+
+/*
+ * @returns The network's score in centipawns from the point of view
+ *          of the side to move
+ */
+int nnue_evaluate(void) {
+  int const index = pos_moves.index;
+  Accumulator *const accumulator = &stack[index & (NNUE_STACK - 1)];
+
+  for (int perspective = WHITE; perspective <= BLACK; perspective++)
+    if (accumulator->valid_for[perspective] != index + 1)
+      update(index, perspective);
+  return forward(accumulator->values[pos_side], accumulator->values[!pos_side]);
+}
+
+/*
+ * Loads a weight file, replacing the current network. Must not be
+ * called while another thread evaluates.
+ * @returns 0 on success, -1 if the file can't be read or doesn't
+ *          match the network's dimensions
+ */
+int nnue_load(char const *const path) {
+  FILE *const file = fopen(path, "rb");
+  if (!file)
+    return -1;
+
+  char magic[8];
+  uint32_t dimensions[3];
+  Network *const loaded = aligned_alloc(64, sizeof(Network));
+  bool ok = loaded &&
+            fread(magic, sizeof(magic), 1, file) == 1 && !memcmp(magic, NNUE_MAGIC, sizeof(magic)) &&
+            fread(dimensions, sizeof(dimensions), 1, file) == 1 &&
+            dimensions[0] == NNUE_FEATURES && dimensions[1] == NNUE_HIDDEN && dimensions[2] == NNUE_L1 &&
+            fread(loaded->ft_biases, sizeof(loaded->ft_biases), 1, file) == 1 &&
+            fread(loaded->ft_weights, sizeof(loaded->ft_weights), 1, file) == 1 &&
+            fread(loaded->l1_biases, sizeof(loaded->l1_biases), 1, file) == 1 &&
+            fread(loaded->l1_weights, sizeof(loaded->l1_weights), 1, file) == 1 &&
+            fread(&loaded->out_bias, sizeof(loaded->out_bias), 1, file) == 1 &&
+            fread(loaded->out_weights, sizeof(loaded->out_weights), 1, file) == 1 &&
+            fgetc(file) == EOF;
+  fclose(file);
+
+  if (!ok) {
+    free(loaded);
+    return -1;
+  }
+  free(network);
+  network = loaded;
+  nnue_invalidate();
+  return 0;
+}
+
+/*
+ * Switches evaluate() to the network. Other threads have to set up
+ * their position again (load_fen(), board_restore(), ...) afterwards.
+ * @returns Whether the network is now used, which requires nnue_load()
+ */
+bool nnue_enable(bool const enabled) {
+  nnue_enabled = enabled && network;
+  nnue_invalidate();
+  return nnue_enabled;
+}
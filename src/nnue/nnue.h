@@ -0,0 +1,21 @@
+#ifndef SPARK_NNUE_H
+#define SPARK_NNUE_H
+#include <stdbool.h>
+#include "../Types.h"
+
+#define NNUE_FEATURES (64 * 12 * 64) // king square, piece, square (HalfKA)
+#define NNUE_HIDDEN 256
+#define NNUE_L1 32
+
+extern bool nnue_enabled;
+
+int nnue_load(char const *path);
+bool nnue_enable(bool enabled);
+int nnue_evaluate(void);
+
+// board hooks, see board.c
+void nnue_make_move(MOVE move, int captured);
+void nnue_null_move(void);
+void nnue_invalidate(void);
+
+#endif
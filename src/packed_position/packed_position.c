@@ -0,0 +1,138 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../board/board.h"
+#include "../board_utils/board_utils.h"
+#include "../zobrist/zobrist.h"
+#include "../eval/eval.h"
+#include "packed_position.h"
+
+_Static_assert(sizeof(PackedPosition) == 32, "PackedPosition must be 32 bytes");
+
+/*
+ * Packs the position of the global board.
+ * @returns false if there are more than 32 pieces
+ */
+bool pack_position(PackedPosition *const out) {
+  BB occ = pos_occupancies[BOTH];
+
+  if (POPCNT(occ) > 32)
+    return false;
+
+  *out = (PackedPosition) {0};
+  out->occupancy = occ;
+  for (int i = 0; occ; i++) {
+    int const square = FIRST_SET_BIT(occ);
+    out->pieces[i / 2] |= pos_occupancy[square] << (4 * (i & 1));
+    CLEAR_BIT(occ, square);
+  }
+  out->side = pos_side;
+  out->castling = pos_castling;
+  out->ep = pos_ep;
+  out->halfmove = pos_halfmove > UINT8_MAX ? UINT8_MAX : pos_halfmove;
+  out->fullmove = pos_fullmove > UINT16_MAX ? UINT16_MAX : pos_fullmove;
+  return true;
+}
+
+/*
+ * Sets up the global board from a record, without any parsing. The
+ * position is checked with validate_position() like load_fen() input.
+ * @returns false (leaving an empty board) if the record is malformed
+ */
+bool unpack_position(PackedPosition const *const in) {
+  clean_board();
+
+  if (POPCNT(in->occupancy) > 32 || in->side > BLACK || in->castling > 15 ||
+      in->ep > none || in->fullmove == 0)
+    return false;
+
+  BB occ = in->occupancy;
+  for (int i = 0; occ; i++) {
+    int const square = FIRST_SET_BIT(occ);
+    int const piece = (in->pieces[i / 2] >> (4 * (i & 1))) & 15;
+
+    if (piece > k) {
+      clean_board();
+      return false;
+    }
+    pos_pieces[piece] |= 1ULL << square;
+    pos_occupancy[square] = piece;
+    pos_occupancies[piece < p ? WHITE : BLACK] |= 1ULL << square;
+    CLEAR_BIT(occ, square);
+  }
+  pos_occupancies[BOTH] = in->occupancy;
+  pos_side = in->side;
+  pos_castling = in->castling;
+  pos_ep = in->ep;
+  pos_halfmove = in->halfmove;
+  pos_fullmove = in->fullmove;
+  if (!validate_position()) {
+    clean_board();
+    return false;
+  }
+  pos_key = compute_key();
+  compute_eval_state(&pos_eval);
+  return true;
+}
+
+/*
+ * Maps a file of records read-only. The records can then be
+ * iterated directly through file->records.
+ * @returns 0 on success, -1 on error or if the file size is
+ *          not a multiple of the record size
+ */
+int position_file_open(PositionFile *const file, char const *const path) {
+  *file = (PositionFile) {0};
+
+  int const fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size % sizeof(PackedPosition)) {
+    close(fd);
+    return -1;
+  }
+
+  if (st.st_size > 0) {
+    void *const map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      close(fd);
+      return -1;
+    }
+    posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+    file->records = map;
+    file->map_size = st.st_size;
+    file->count = st.st_size / sizeof(PackedPosition);
+  }
+  close(fd); // the mapping stays valid
+  return 0;
+}
+
+void position_file_close(PositionFile *const file) {
+  if (file->records)
+    munmap((void *) file->records, file->map_size);
+  *file = (PositionFile) {0};
+}
+
+/*
+ * Opens a file for appending records.
+ * @returns 0 on success, -1 on error
+ */
+int position_writer_open(PositionWriter *const writer, char const *const path) {
+  writer->file = fopen(path, "ab");
+  return writer->file ? 0 : -1;
+}
+
+int position_writer_add(PositionWriter *const writer, PackedPosition const *const record) {
+  return fwrite(record, sizeof(*record), 1, writer->file) == 1 ? 0 : -1;
+}
+
+int position_writer_close(PositionWriter *const writer) {
+  int const result = fclose(writer->file);
+  writer->file = NULL;
+  return result == 0 ? 0 : -1;
+}
@@ -0,0 +1,46 @@
+#ifndef SPARK_PACKED_POSITION_H
+#define SPARK_PACKED_POSITION_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "../Types.h"
+
+/*
+ * Fixed-size 32 byte position record. The pieces are stored as 4-bit
+ * piece codes (P..k), one per set bit of occupancy in ascending square
+ * order, two per byte with the lower square in the low nibble.
+ * Records are written in host byte order.
+ */
+typedef struct PackedPosition {
+  BB occupancy;
+  uint8_t pieces[16];
+  uint8_t side;
+  uint8_t castling;
+  uint8_t ep;
+  uint8_t halfmove;
+  uint16_t fullmove;
+  uint8_t reserved[2];
+} PackedPosition;
+
+typedef struct PositionFile {
+  PackedPosition const *records;
+  size_t count;
+  size_t map_size;
+} PositionFile;
+
+typedef struct PositionWriter {
+  FILE *file;
+} PositionWriter;
+
+bool pack_position(PackedPosition *out);
+bool unpack_position(PackedPosition const *in);
+
+int position_file_open(PositionFile *file, char const *path);
+void position_file_close(PositionFile *file);
+
+int position_writer_open(PositionWriter *writer, char const *path);
+int position_writer_add(PositionWriter *writer, PackedPosition const *record);
+int position_writer_close(PositionWriter *writer);
+
+#endif
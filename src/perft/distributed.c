@@ -0,0 +1,298 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../../inc/spark.h"
+#include "perft.h"
+
+/*
+ * Multi-process perft. The coordinator splits the tree below the
+ * current position into subtree jobs (FEN plus remaining depth), one
+ * per root move, or one per pair of root move and reply for deeper
+ * runs, and hands them to forked worker processes over Unix domain
+ * socket pairs. The line protocol is
+ *
+ *   coordinator -> worker:  <depth> <fen>\n
+ *   worker -> coordinator:  <nodes>\n, or error\n for a bad job
+ *
+ * A worker that dies is replaced and its job is handed out again,
+ * so one crashing process doesn't lose the run.
+ */
+
+#define MAX_JOB_ATTEMPTS 3
+#define SPLIT_TWO_PLIES_DEPTH 5 // from this depth on, jobs start after the replies
+
+typedef struct PerftJob {
+  char fen[100];
+  int depth;
+  int root; // index of the root move the subtree belongs to
+  int attempts;
+  enum { JOB_PENDING, JOB_RUNNING, JOB_DONE } state;
+  BB nodes;
+} PerftJob;
+
+typedef struct PerftWorker {
+  pid_t pid;
+  int fd;
+  int job; // -1 when idle
+  char reply[32];
+  int reply_length;
+} PerftWorker;
+
+static PerftJob *jobs;
+static int job_count;
+static int job_capacity;
+
+static void add_job(int depth, int root);
+static void split_jobs(int depth, MoveList const *roots);
+static void worker_loop(int fd);
+static int spawn_worker(PerftWorker *workers, int index, int worker_count);
+static int restart_worker(PerftWorker *workers, int index, int worker_count);
+static int assign_job(PerftWorker *worker);
+static int read_reply(PerftWorker *worker);
+
+static void add_job(int const depth, int const root) {
+  if (job_count == job_capacity) {
+    job_capacity = job_capacity ? 2 * job_capacity : 1024;
+    jobs = realloc(jobs, job_capacity * sizeof(PerftJob));
+    if (!jobs) {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  PerftJob *const job = &jobs[job_count++];
+  board_to_fen(job->fen, sizeof(job->fen));
+  job->depth = depth;
+  job->root = root;
+  job->attempts = 0;
+  job->state = JOB_PENDING;
+  job->nodes = 0;
+}
+
+static void split_jobs(int const depth, MoveList const *const roots) {
+  for (int i = 0; i < roots->current_index; i++) {
+    make_move(roots->moves[i]);
+    if (depth < SPLIT_TWO_PLIES_DEPTH) {
+      add_job(depth - 1, i);
+    } else {
+      MoveList replies;
+      generate_moves_into(&replies);
+      for (int j = 0; j < replies.current_index; j++) {
+        make_move(replies.moves[j]);
+        add_job(depth - 2, i);
+        takeback();
+      }
+    }
+    takeback();
+  }
+}
+
+/*
+ * Runs in the worker process until the coordinator closes the socket.
+ */
+static void worker_loop(int const fd) {
+  FILE *const in = fdopen(fd, "r");
+  char line[160];
+
+  while (in && fgets(line, sizeof(line), in)) {
+    char *fen;
+    long const depth = strtol(line, &fen, 10);
+    bool const valid_depth = fen != line && depth >= 0 && depth <= MAX_PERFT_DEPTH;
+
+    fen += strspn(fen, " ");
+    fen[strcspn(fen, "\n")] = '\0';
+    int const written = valid_depth && load_fen(fen) ? dprintf(fd, "%lu\n", perft(depth)) : dprintf(fd, "error\n");
+    if (written < 0)
+      break;
+  }
+  _exit(EXIT_SUCCESS);
+}
+
+/*
+ * Forks worker index. The child closes the coordinator's ends of the
+ * other workers' sockets, so that only the coordinator holds them.
+ * @returns 0 on success, -1 on error
+ */
+static int spawn_worker(PerftWorker *const workers, int const index, int const worker_count) {
+  int sockets[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0)
+    return -1;
+
+  fflush(stdout); // don't let the child inherit pending output
+  pid_t const pid = fork();
+  if (pid < 0) {
+    close(sockets[0]);
+    close(sockets[1]);
+    return -1;
+  }
+  if (pid == 0) {
+    close(sockets[0]);
+    for (int i = 0; i < worker_count; i++)
+      if (i != index && workers[i].fd >= 0)
+        close(workers[i].fd);
+    worker_loop(sockets[1]);
+  }
+
+  close(sockets[1]);
+  workers[index] = (PerftWorker) {.pid = pid, .fd = sockets[0], .job = -1};
+  return 0;
+}
+
+/*
+ * Replaces a worker that died or can't be written to, and puts its
+ * job back in the queue.
+ * @returns -1 if the job failed too often or no worker can be started
+ */
+static int restart_worker(PerftWorker *const workers, int const index, int const worker_count) {
+  PerftJob *const job = &jobs[workers[index].job];
+
+  fprintf(stderr, "perft worker %d died, requeuing %d %s\n", (int) workers[index].pid, job->depth, job->fen);
+  close(workers[index].fd);
+  waitpid(workers[index].pid, NULL, 0);
+  workers[index].fd = -1;
+  workers[index].job = -1;
+  job->state = JOB_PENDING;
+
+  if (job->attempts >= MAX_JOB_ATTEMPTS)
+    return -1;
+  return spawn_worker(workers, index, worker_count);
+}
+
+/*
+ * Sends the next pending job to an idle worker.
+ * @returns 0 if a job was sent or none is pending, -1 if the
+ *          worker can't be written to
+ */
+static int assign_job(PerftWorker *const worker) {
+  for (int i = 0; i < job_count; i++) {
+    if (jobs[i].state != JOB_PENDING)
+      continue;
+
+    jobs[i].state = JOB_RUNNING;
+    jobs[i].attempts++;
+    worker->job = i;
+    worker->reply_length = 0;
+    return dprintf(worker->fd, "%d %s\n", jobs[i].depth, jobs[i].fen) < 0 ? -1 : 0;
+  }
+  return 0;
+}
+
+/*
+ * Reads the reply of a busy worker.
+ * @returns 1 if the job is complete, 0 if the reply is incomplete,
+ *          -1 if the worker is gone, -2 if it rejected the job
+ */
+static int read_reply(PerftWorker *const worker) {
+  ssize_t const n = read(worker->fd, worker->reply + worker->reply_length,
+                         sizeof(worker->reply) - 1 - worker->reply_length);
+  if (n < 0 && errno == EINTR)
+    return 0;
+  if (n <= 0)
+    return -1;
+
+  worker->reply_length += n;
+  worker->reply[worker->reply_length] = '\0';
+  if (!strchr(worker->reply, '\n'))
+    return worker->reply_length < (int) sizeof(worker->reply) - 1 ? 0 : -1;
+
+  PerftJob *const job = &jobs[worker->job];
+  if (!strncmp(worker->reply, "error", 5)) {
+    fprintf(stderr, "perft worker %d rejected %d %s\n", (int) worker->pid, job->depth, job->fen);
+    return -2;
+  }
+  job->nodes = strtoull(worker->reply, NULL, 10);
+  job->state = JOB_DONE;
+  worker->job = -1;
+  return 1;
+}
+
+/*
+ * Counts the nodes of the current position with worker_count worker
+ * processes and prints the subtotal of every root move, like divide().
+ * @returns The node count, or 0 (with a message) if the run failed
+ *          or depth or worker_count is out of range
+ */
+BB perft_distributed(int const depth, int const worker_count) {
+  if (depth < 0 || depth > MAX_PERFT_DEPTH || worker_count < 1 || worker_count > PERFT_MAX_WORKERS) {
+    fprintf(stderr, "Depth must be between 0 and %d, workers between 1 and %d\n", MAX_PERFT_DEPTH, PERFT_MAX_WORKERS);
+    return 0;
+  }
+  if (depth < 2)
+    return perft(depth);
+
+  MoveList roots;
+  generate_moves_into(&roots);
+  job_count = 0;
+  split_jobs(depth, &roots);
+
+  signal(SIGPIPE, SIG_IGN); // a dead worker shows up as a write error instead
+
+  PerftWorker *const workers = calloc(worker_count, sizeof(PerftWorker));
+  struct pollfd *const fds = calloc(worker_count, sizeof(struct pollfd));
+  int remaining = job_count;
+  bool failed = !workers || !fds;
+
+  for (int i = 0; i < worker_count && !failed; i++)
+    workers[i].fd = -1;
+  for (int i = 0; i < worker_count && !failed; i++)
+    failed = spawn_worker(workers, i, worker_count) < 0;
+
+  while (remaining > 0 && !failed) {
+    for (int i = 0; i < worker_count && !failed; i++) {
+      if (workers[i].job < 0 && assign_job(&workers[i]) < 0)
+        failed = restart_worker(workers, i, worker_count) < 0 || assign_job(&workers[i]) < 0;
+      // idle workers are left out, there is nothing left for them
+      fds[i] = (struct pollfd) {.fd = workers[i].job < 0 ? -1 : workers[i].fd, .events = POLLIN};
+    }
+
+    if (failed || (poll(fds, worker_count, -1) < 0 && errno != EINTR))
+      break;
+
+    for (int i = 0; i < worker_count && !failed; i++) {
+      if (fds[i].fd < 0 || !fds[i].revents)
+        continue;
+
+      int const result = read_reply(&workers[i]);
+      if (result > 0)
+        remaining--;
+      else if (result == -2)
+        failed = true;
+      else if (result < 0)
+        failed = restart_worker(workers, i, worker_count) < 0;
+    }
+  }
+  failed |= remaining > 0;
+
+  // closing the sockets ends the workers
+  for (int i = 0; workers && i < worker_count; i++) {
+    if (workers[i].fd >= 0) {
+      close(workers[i].fd);
+      waitpid(workers[i].pid, NULL, 0);
+    }
+  }
+  free(workers);
+  free(fds);
+
+  if (failed) {
+    fprintf(stderr, "Distributed perft failed\n");
+    return 0;
+  }
+
+  BB total = 0;
+  for (int i = 0; i < roots.current_index; i++) {
+    BB nodes = 0;
+    for (int j = 0; j < job_count; j++)
+      if (jobs[j].root == i)
+        nodes += jobs[j].nodes;
+    printf("%s: %lu\n", get_move_UCI(roots.moves[i]), nodes);
+    total += nodes;
+  }
+  return total;
+}
@@ -1,13 +1,27 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "../../inc/spark.h"
 #include "perft.h"
 
-BB perft_captures = 0;
-BB perft_eps = 0;
-BB perft_castles = 0;
-BB perft_promotions = 0;
+#define CHECKPOINT_MAGIC 0x31465245504B5053ULL // "SPKPERF1"
+
+// one move list per remaining depth, so that recursion doesn't put a list on the stack
+static MoveList move_stack[MAX_PERFT_DEPTH + 1];
+
+// used by perft_suite() when opened, see main()
+static PerftCheckpoint suite_checkpoint;
+
+static bool parse_number(char const *text, int min, int max, int *out);
+static uint64_t checkpoint_key(int depth);
+static PerftCheckpointEntry *checkpoint_entry(PerftCheckpointFile *file, uint64_t key, int depth, MoveList const *roots);
+
 struct perf_test {
   char title[20];
   char pos[256];
@@ -50,12 +64,119 @@ struct perf_test pos_list[] = { // results taken from chessprogramming.org/Perft
 
 
 
-int main(void) {
+// leaf statistics taken from chessprogramming.org/Perft_Results
+struct stats_test {
+  char title[20];
+  char pos[256];
+  PerftStats stats[8];
+  int d_count;
+};
+
+struct stats_test stats_list[] = {
+  {
+    "Position 1",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    {
+      {20, 0, 0, 0, 0, 0, 0, 0, 0},
+      {400, 0, 0, 0, 0, 0, 0, 0, 0},
+      {8902, 34, 0, 0, 0, 12, 0, 0, 0},
+      {197281, 1576, 0, 0, 0, 469, 0, 0, 8},
+      {4865609, 82719, 258, 0, 0, 27351, 6, 0, 347}
+    }, 5
+  },
+  {
+    "Position 2",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -",
+    {
+      {48, 8, 0, 2, 0, 0, 0, 0, 0},
+      {2039, 351, 1, 91, 0, 3, 0, 0, 0},
+      {97862, 17102, 45, 3162, 0, 993, 0, 0, 1},
+      {4085603, 757163, 1929, 128013, 15172, 25523, 42, 6, 43}
+    }, 4
+  },
+  {
+    "Position 3",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -",
+    {
+      {14, 1, 0, 0, 0, 2, 0, 0, 0},
+      {191, 14, 0, 0, 0, 10, 0, 0, 0},
+      {2812, 209, 2, 0, 0, 267, 3, 0, 0},
+      {43238, 3348, 123, 0, 0, 1680, 106, 0, 17},
+      {674624, 52051, 1165, 0, 0, 52950, 1292, 3, 0}
+    }, 5
+  },
+  {
+    "Position 4",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    {
+      {6, 0, 0, 0, 0, 0, 0, 0, 0},
+      {264, 87, 0, 6, 48, 10, 0, 0, 0},
+      {9467, 1021, 4, 0, 120, 38, 2, 0, 22},
+      {422333, 131393, 0, 7795, 60032, 15492, 19, 0, 5}
+    }, 4
+  }
+};
+
+
+
+/*
+ * @returns false if text isn't a whole number in [min, max]
+ */
+static bool parse_number(char const *const text, int const min, int const max, int *const out) {
+  char *end;
+  long const value = strtol(text, &end, 10);
+
+  if (end == text || *end || value < min || value > max)
+    return false;
+  *out = value;
+  return true;
+}
+
+/*
+ * Usage: perft [checkpoint-file]
+ *        perft -j <workers> <depth> [fen]
+ * With a checkpoint file, completed root moves of the perft suite
+ * are saved to it and skipped when the run is restarted. With -j,
+ * a single perft (startpos by default) is split over worker processes.
+ */
+int main(int argc, char *argv[]) {
   printf("engine started\n\n");
   init_attack_tables();
+
+  if (argc > 3 && !strcmp(argv[1], "-j")) {
+    int workers, depth;
+    if (!parse_number(argv[2], 1, PERFT_MAX_WORKERS, &workers) || !parse_number(argv[3], 1, MAX_PERFT_DEPTH, &depth)) {
+      fprintf(stderr, "Workers must be between 1 and %d, depth between 1 and %d\n", PERFT_MAX_WORKERS, MAX_PERFT_DEPTH);
+      return EXIT_FAILURE;
+    }
+    if (!load_fen(argc > 4 ? argv[4] : pos_list[0].pos)) {
+      fprintf(stderr, "Invalid FEN %s\n", argv[4]);
+      return EXIT_FAILURE;
+    }
+    clock_t const start = clock();
+    BB const nodes = perft_distributed(depth, workers);
+    printf("\nNodes: %lu\n", nodes);
+    printf("Time taken: %lu ms (coordinator CPU)\n", (BB) ((clock() - start) * 1000 / CLOCKS_PER_SEC));
+    return nodes ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (argc > 1) {
+    if (perft_checkpoint_open(&suite_checkpoint, argv[1]) < 0) {
+      fprintf(stderr, "Cannot open checkpoint file %s\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+    printf("using checkpoint file %s\n", argv[1]);
+  }
 //  benchmark();  
+  fen_suite();
+  perft_stats_suite();
+  perft_cross_check_suite(3);
+  polyglot_suite();
+  draw_suite();
+  playout_suite();
   perft_suite(8);
-  
+
+  perft_checkpoint_close(&suite_checkpoint);
   return EXIT_SUCCESS;
 }
 
@@ -71,6 +192,14 @@ void perft_suite(int max_depth) {
   
   printf("\n--> Running perft positions\n");
 
+  PerftStats stats = {0};
+  parse_fen(pos_list[0].pos);
+  if (perft(-1) || perft(MAX_PERFT_DEPTH + 1) || perft_checkpointed(MAX_PERFT_DEPTH + 1, &suite_checkpoint) ||
+      perft_detailed(-1, &stats) || perft_detailed(MAX_PERFT_DEPTH + 1, &stats)) {
+    printf("\nout of range depths failed :(\n");
+    exit(1);
+  }
+
   int pos_count = sizeof(pos_list) / sizeof(pos_list[0]);
   for (int i = 0; i < pos_count; i++) {
     printf("\n[ %s ]\n",pos_list[i].title);
@@ -78,7 +207,7 @@ void perft_suite(int max_depth) {
     for (int j = 0; j <= max_depth && j < pos_list[i].d_count; j++) {
       printf("depth %d: ", j + 1);
       fflush(stdout);
-      if (perft(j + 1) != pos_list[i].nodes[j]) {
+      if (perft_checkpointed(j + 1, &suite_checkpoint) != pos_list[i].nodes[j]) {
         printf("failed :(\n");
         exit(1);
       }
@@ -89,82 +218,819 @@ void perft_suite(int max_depth) {
   printf("\nAll tests passed!\n");
 }
 
+void perft_stats_suite(void) {
+
+  printf("\n--> Running perft statistics\n");
+
+  int pos_count = sizeof(stats_list) / sizeof(stats_list[0]);
+  for (int i = 0; i < pos_count; i++) {
+    printf("\n[ %s ]\n", stats_list[i].title);
+    parse_fen(stats_list[i].pos);
+    for (int j = 0; j < stats_list[i].d_count; j++) {
+      PerftStats stats = {0};
+      PerftStats const *expected = &stats_list[i].stats[j];
+      printf("depth %d: ", j + 1);
+      fflush(stdout);
+      perft_detailed(j + 1, &stats);
+      if (stats.nodes != expected->nodes ||
+          stats.captures != expected->captures ||
+          stats.eps != expected->eps ||
+          stats.castles != expected->castles ||
+          stats.promotions != expected->promotions ||
+          stats.checks != expected->checks ||
+          stats.discovered_checks != expected->discovered_checks ||
+          stats.double_checks != expected->double_checks ||
+          stats.checkmates != expected->checkmates) {
+        printf("failed :(\n");
+        print_perft_stats(&stats);
+        exit(1);
+      }
+      printf("success :)\n");
+    }
+  }
+
+  printf("\nAll statistics match!\n");
+}
+
+static struct {
+  char const *fen;
+  bool valid;
+} const fen_list[] = {
+  {"rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1", true},
+  {"rnbqkbnr/ppp1pppp/8/3pP3/8/8/PPPP1PPP/RNBQKBNR w KQkq d6 0 2", true},
+  {"K7/8/8/8/8/8/8/7k w - -", true},                      // no clocks
+  {"K7/8/8/8/8/8/8/7k w -", false},                       // no ep field
+  {"K7/8/8/8/8/8/8/7k", false},                           // no side to move
+  {"", false},
+  {"4k3/8/8/3nP3/8/8/8/4K3 w - d6 0 1", false},           // no pawn in front of the ep square
+  {"4k3/3p4/8/3pP3/8/8/8/4K3 w - d6 0 1", false},         // the pawn's origin is occupied
+  {"4k3/8/3n4/3pP3/8/8/8/4K3 w - d6 0 1", false},         // the ep square is occupied
+  {"4k3/8/8/3pP3/8/8/8/4K3 w - d3 0 1", false},           // wrong rank for the side to move
+  {"4k3/8/8/8/3Pp3/8/8/4K3 b - e3 0 1", false},           // the pawn is the mover's own
+  {"4k3/8/8/8/8/8/8/4K2K w - - 0 1", false},              // two white kings
+  {"4k3/8/8/8/8/8/8/8 w - - 0 1", false},                 // no white king
+  {"P3k3/8/8/8/8/8/8/4K3 w - - 0 1", false},              // pawn on the last rank
+  {"4k2R/8/8/8/8/8/8/4K3 w - - 0 1", false},              // side not to move in check
+  {"4k3/8/8/8/8/8/8/4K3 x - - 0 1", false},               // no side to move
+};
+
+/*
+ * Checks that load_fen() accepts legal positions and rejects
+ * illegal ones.
+ */
+void fen_suite(void) {
+
+  printf("\n--> Running FEN checks\n");
+
+  int const fen_count = sizeof(fen_list) / sizeof(fen_list[0]);
+  for (int i = 0; i < fen_count; i++) {
+    if (load_fen(fen_list[i].fen) != fen_list[i].valid) {
+      printf("%s %s failed :(\n", fen_list[i].valid ? "accepting" : "rejecting", fen_list[i].fen);
+      exit(1);
+    }
+  }
+
+  // records that only unpack_position() sees, starting from a legal one
+  PackedPosition record, broken;
+  load_fen("4k3/8/8/3nP3/8/8/8/4K3 w - - 0 1");
+  pack_position(&record);
+  broken = record;
+  broken.ep = d6;
+  bool ok = unpack_position(&record) && !unpack_position(&broken);
+  broken = record;
+  broken.pieces[0] = (broken.pieces[0] & 0xF0) | q; // the black king, first in square order
+  ok = ok && !unpack_position(&broken);
+
+  // the side not to move in check, and castling rights without rooks
+  load_fen("4k3/8/8/8/8/8/8/4R1K1 b - - 0 1");
+  pack_position(&broken);
+  broken.side = WHITE;
+  ok = ok && !unpack_position(&broken);
+  load_fen("4k3/8/8/8/8/8/8/4K3 w - - 0 1");
+  pack_position(&broken);
+  broken.castling = 15; // all four
+  MoveList move_list;
+  ok = ok && unpack_position(&broken);
+  generate_moves_into(&move_list);
+  for (int i = 0; i < move_list.current_index; i++)
+    ok = ok && !GET_MOVE_CASTLING(move_list.moves[i]);
+  if (!ok) {
+    printf("unpacking records failed :(\n");
+    exit(1);
+  }
+  printf("\nAll FEN checks passed!\n");
+}
+
+// the draw queries after playing moves from fen
+static struct {
+  char const *fen;
+  char const *moves;
+  bool repetition, threefold, fifty, insufficient, draw;
+} const draw_list[] = {
+  {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", "g1f3 g8f6 f3g1", false, false, false, false, false},
+  {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", "g1f3 g8f6 f3g1 f6g8", true, false, false, false, false},
+  {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", "g1f3 g8f6 f3g1 f6g8 g1f3 g8f6 f3g1", true, false, false, false, false},
+  {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", "g1f3 g8f6 f3g1 f6g8 g1f3 g8f6 f3g1 f6g8", true, true, false, false, true},
+  {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", "g1f3 g8f6 f3g1 f6g8 e2e4 e7e5", false, false, false, false, false},
+  {"7k/8/6K1/8/8/8/8/R7 w - - 99 80", "", false, false, false, false, false},
+  {"7k/8/6K1/8/8/8/8/R7 w - - 99 80", "a1a2", false, false, true, false, true},
+  {"7k/8/6K1/8/8/8/8/R7 w - - 99 80", "a1a8", false, false, false, false, false}, // mate on the hundredth ply
+  {"7k/8/6K1/8/8/8/8/R7 w - - 99 80", "a1h1", false, false, true, false, true},   // a check that isn't mate
+  {"8/8/4k3/8/8/3BK3/8/8 w - - 0 1", "", false, false, false, true, true},
+  {"8/8/4k3/8/8/3NK3/8/8 w - - 0 1", "", false, false, false, true, true},
+  {"8/8/4k3/8/8/3RK3/8/8 w - - 0 1", "", false, false, false, false, false},
+  {"8/8/4k3/8/8/3PK3/8/8 w - - 0 1", "", false, false, false, false, false},
+};
+
+/*
+ * Checks repetitions, the fifty-move rule and insufficient material
+ * after move sequences.
+ */
+void draw_suite(void) {
+
+  printf("\n--> Running draw checks\n");
+
+  int const draw_count = sizeof(draw_list) / sizeof(draw_list[0]);
+  for (int i = 0; i < draw_count; i++) {
+    char moves[256];
+    bool legal = load_fen(draw_list[i].fen);
+
+    snprintf(moves, sizeof(moves), "%s", draw_list[i].moves);
+    for (char *token = strtok(moves, " "); token && legal; token = strtok(NULL, " ")) {
+      MOVE const move = parse_uci_move(token);
+      legal = move != 0;
+      if (legal)
+        make_move(move);
+    }
+
+    if (!legal || is_repetition() != draw_list[i].repetition ||
+        is_threefold_repetition() != draw_list[i].threefold ||
+        is_fifty_move_draw() != draw_list[i].fifty ||
+        is_insufficient_material() != draw_list[i].insufficient ||
+        is_draw() != draw_list[i].draw) {
+      printf("%s after \"%s\" failed :(\n", draw_list[i].fen, draw_list[i].moves);
+      exit(1);
+    }
+  }
+  printf("\nAll draw checks passed!\n");
+}
+
+/*
+ * @returns Whether the board is in a position the playout result
+ *          says the game ended in
+ */
+static bool is_playout_end(int const result) {
+  bool const moves = has_legal_move();
+  bool const in_check = IS_KING_IN_CHECK(pos_side);
+
+  switch (result) {
+    case PLAYOUT_CHECKMATE: return !moves && in_check;
+    case PLAYOUT_STALEMATE: return !moves && !in_check;
+    case PLAYOUT_FIFTY_MOVES: return moves && is_fifty_move_draw();
+    case PLAYOUT_INSUFFICIENT_MATERIAL: return moves && is_insufficient_material();
+    case PLAYOUT_REPETITION: return moves && is_threefold_repetition();
+    case PLAYOUT_PLY_LIMIT: return moves;
+    default: return false;
+  }
+}
+
+/*
+ * Plays seeded random games twice, which must end the same way in
+ * the same position, and in a position matching their result.
+ */
+void playout_suite(void) {
+
+  printf("\n--> Running playout checks\n");
+
+  for (int game = 0; game < 32; game++) {
+    bool const weighted = game & 1;
+    int results[2];
+    char fens[2][100];
+
+    set_check_flags(weighted);
+    for (int run = 0; run < 2; run++) {
+      PlayoutRng rng;
+      playout_seed(&rng, game);
+      results[run] = play_random_game(pos_list[game % 6].pos, &rng, weighted, NULL);
+      board_to_fen(fens[run], sizeof(fens[run]));
+    }
+    bool const ended = is_playout_end(results[0]);
+    set_check_flags(false);
+
+    if (results[0] != results[1] || strcmp(fens[0], fens[1]) || !ended) {
+      printf("game %d failed :(\nresult %d, position %s\n", game, results[0], fens[0]);
+      exit(1);
+    }
+  }
+
+  PlayoutRng rng;
+  playout_seed(&rng, 0);
+  if (play_random_game("garbage", &rng, false, NULL) != -1) {
+    printf("rejecting a bad start position failed :(\n");
+    exit(1);
+  }
+  printf("\nAll playout checks passed!\n");
+}
+
+// reference keys from the Polyglot book format specification
+static struct {
+  char const *fen;
+  BB key;
+} const polyglot_keys[] = {
+  {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 0x463B96181691FC9CULL},
+  {"rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1", 0x823C9B50FD114196ULL},
+  {"rnbqkbnr/ppp1pppp/8/3p4/4P3/8/PPPP1PPP/RNBQKBNR w KQkq d6 0 2", 0x0756B94461C50FB0ULL},
+  {"rnbqkbnr/ppp1pppp/8/3pP3/8/8/PPPP1PPP/RNBQKBNR b KQkq - 0 2", 0x662FAFB965DB29D4ULL},
+  {"rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3", 0x22A48B5A8E47FF78ULL},
+  {"rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR b kq - 0 3", 0x652A607CA3F242C1ULL},
+  {"rnbq1bnr/ppp1pkpp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR w - - 0 4", 0x00FDD303C946BDD9ULL},
+  {"rnbqkbnr/p1pppppp/8/8/PpP4P/8/1P1PPPP1/RNBQKBNR b KQkq c3 0 3", 0x3C8123EA7B067637ULL},
+  {"rnbqkbnr/p1pppppp/8/8/P6P/R1p5/1P1PPPP1/1NBQKBNR b Kkq - 0 4", 0x5C3F9B829B279560ULL},
+};
+
+struct book_entry {
+  BB key;
+  unsigned move;
+  unsigned weight;
+};
+
+static void write_be(uint8_t *const bytes, BB value, int const size) {
+  for (int i = size - 1; i >= 0; i--, value >>= 8)
+    bytes[i] = value & 0xFF;
+}
+
+/*
+ * Checks polyglot_key() against the reference keys, then probes a
+ * small book with entries as other programs write them.
+ */
+void polyglot_suite(void) {
+
+  printf("\n--> Running polyglot checks\n");
+
+  int const key_count = sizeof(polyglot_keys) / sizeof(polyglot_keys[0]);
+  for (int i = 0; i < key_count; i++) {
+    load_fen(polyglot_keys[i].fen);
+    if (polyglot_key() != polyglot_keys[i].key) {
+      printf("key of %s failed :(\n", polyglot_keys[i].fen);
+      exit(1);
+    }
+  }
+
+  // start position e2e4 and d2d4, then white castling short as e1h1
+  char const *const castling_fen = "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1";
+  load_fen(castling_fen);
+  BB const castling_key = polyglot_key();
+  BB const start_key = polyglot_keys[0].key;
+  int const castling_at = castling_key < start_key ? 0 : 2; // entries are sorted by key
+  struct book_entry entries[3];
+  entries[castling_at] = (struct book_entry) {castling_key, 0x0107, 1};
+  entries[!castling_at] = (struct book_entry) {start_key, 0x031C, 2};
+  entries[!castling_at + 1] = (struct book_entry) {start_key, 0x02DB, 1};
+
+  char path[] = "/tmp/spark-book-XXXXXX";
+  int const fd = mkstemp(path);
+  if (fd < 0) {
+    printf("cannot create a book file :(\n");
+    exit(1);
+  }
+  uint8_t bytes[3 * POLYGLOT_ENTRY_SIZE] = {0};
+  for (int i = 0; i < 3; i++) {
+    write_be(bytes + i * POLYGLOT_ENTRY_SIZE, entries[i].key, 8);
+    write_be(bytes + i * POLYGLOT_ENTRY_SIZE + 8, entries[i].move, 2);
+    write_be(bytes + i * POLYGLOT_ENTRY_SIZE + 10, entries[i].weight, 2);
+  }
+  bool const written = write(fd, bytes, sizeof(bytes)) == (ssize_t) sizeof(bytes);
+  close(fd);
+
+  PolyglotBook book;
+  bool const opened = written && polyglot_open(&book, path) == 0;
+  unlink(path);
+  if (!opened) {
+    printf("cannot open the book :(\n");
+    exit(1);
+  }
+
+  BookMove moves[4];
+  parse_fen(pos_list[0].pos);
+  int const start_count = polyglot_probe(&book, moves, 4);
+  bool ok = start_count == 2 &&
+            moves[0].move == parse_uci_move("e2e4") && moves[0].weight == 2 &&
+            moves[1].move == parse_uci_move("d2d4") && moves[1].weight == 1;
+  load_fen(castling_fen);
+  ok = ok && polyglot_probe(&book, moves, 4) == 1 && moves[0].move == parse_uci_move("e1g1");
+  polyglot_close(&book);
+
+  if (!ok) {
+    printf("book probe failed :(\n");
+    exit(1);
+  }
+  printf("\nAll polyglot checks passed!\n");
+}
+
+void print_perft_stats(PerftStats const *stats) {
+  printf("Total moves: %lu\n", stats->nodes);
+  printf("Captures: %lu\n", stats->captures);
+  printf("Eps: %lu\n", stats->eps);
+  printf("Castles: %lu\n", stats->castles);
+  printf("Promotions: %lu\n", stats->promotions);
+  printf("Checks: %lu\n", stats->checks);
+  printf("Discovered checks: %lu\n", stats->discovered_checks);
+  printf("Double checks: %lu\n", stats->double_checks);
+  printf("Checkmates: %lu\n", stats->checkmates);
+}
+
 void run_perft(int depth) {
 
-  BB nodes;
   clock_t start, end;
   BB time_used;
 
   for (int i = 1; i <= depth; i++) {
 
-    perft_captures = 0;
-    perft_eps = 0;
-    perft_castles = 0;
-    perft_promotions = 0;
+    PerftStats stats = {0};
 
     start = clock();
-    nodes = perft(i);
+    if (!perft_detailed(i, &stats))
+      break;
     end = clock();
     time_used = ((end - start) * 1000) / CLOCKS_PER_SEC;
 
     printf("\nDepth %d\n", i);
     printf("=================\n");
-    printf("Total moves: %lu\n", nodes);
-    printf("Captures: %lu\n", perft_captures);
-    printf("Eps: %lu\n", perft_eps);
-    printf("Castles: %lu\n", perft_castles);
-    printf("Promotions: %lu\n", perft_promotions);
+    print_perft_stats(&stats);
     printf("Time taken: %lu ms\n", time_used);
   }
 }
 
 void divide(int const depth) {
 
-  MoveList const move_list = generate_moves();
+  if (depth < 1 || depth > MAX_PERFT_DEPTH) {
+    printf("depth must be between 1 and %d\n", MAX_PERFT_DEPTH);
+    return;
+  }
+  MoveList *const move_list = &move_stack[depth];
+  generate_moves_into(move_list);
 
-  for (int i = 0; i < move_list.current_index; i++) {
+  for (int i = 0; i < move_list->current_index; i++) {
 
     BB nodes = 0;
-    //print_move_UCI(move_list.moves[i]);
-    printf("%s: ",get_move_UCI(move_list.moves[i]));
+    //print_move_UCI(move_list->moves[i]);
+    printf("%s: ",get_move_UCI(move_list->moves[i]));
     fflush(stdout);
-    make_move(move_list.moves[i]);
+    make_move(move_list->moves[i]);
     nodes += perft(depth - 1);
     takeback();
     printf("%lu\n", nodes);
   }
 }
 
-BB perft(int const depth) {
+/*
+ * Classifies the checks of a leaf move from the checkers of the
+ * position after it. As in the published tables, a double check is
+ * counted only as such, and a single check by a piece other than the
+ * one that landed on the target square is a discovered check.
+ */
+static void count_leaf(MOVE const move, PerftStats *const stats) {
 
-  BB nodes = 0;
+  stats->nodes++;
 
-  if (depth == 0)
-    return 1ULL;
+  if (GET_MOVE_CAPTURE(move))
+    stats->captures++;
+
+  if (GET_MOVE_EP(move))
+    stats->eps++;
+
+  if (GET_MOVE_CASTLING(move))
+    stats->castles++;
+
+  if (GET_MOVE_PROMOTION(move))
+    stats->promotions++;
+
+  make_move(move);
+  int const king_sq = FIRST_SET_BIT(pos_pieces[pos_side == WHITE ? K : k]);
+  BB const checkers = attackers_to(king_sq, pos_occupancies[BOTH]) & pos_occupancies[!pos_side];
+
+  if (checkers) {
+    stats->checks++;
+    if (checkers & (checkers - 1))
+      stats->double_checks++;
+    else if (checkers & ~(1ULL << GET_MOVE_TARGET(move)))
+      stats->discovered_checks++;
+    if (!has_legal_move())
+      stats->checkmates++;
+  }
+  takeback();
+}
 
-  MoveList const move_list = generate_moves();
+/*
+ * Like perft(), collecting leaf statistics in the caller's stats,
+ * so that separate threads can each keep their own.
+ * @returns false if depth is outside [0, MAX_PERFT_DEPTH]
+ */
+bool perft_detailed(int const depth, PerftStats *const stats) {
+
+  if (depth < 0 || depth > MAX_PERFT_DEPTH)
+    return false;
+  if (depth == 0) {
+    stats->nodes++;
+    return true;
+  }
 
-  for (int i = 0; i < move_list.current_index; i++) {
+  MoveList *const move_list = &move_stack[depth];
+  generate_moves_into(move_list);
 
+  for (int i = 0; i < move_list->current_index; i++) {
     if (depth == 1) {
-      if (GET_MOVE_CAPTURE(move_list.moves[i]))
-        perft_captures++;
+      count_leaf(move_list->moves[i], stats);
+      continue;
+    }
+    make_move(move_list->moves[i]);
+    perft_detailed(depth - 1, stats);
+    takeback();
+  }
+  return true;
+}
+
+// positions waiting for count_moves_batch(), with their generated move counts
+static PositionBatch cross_check_batch;
+static int cross_check_expected[BATCH_CAPACITY];
+static uint64_t cross_check_random = 0x2545F4914F6CDD1DULL;
+// promotions, en passant captures and castlings seen by the compress_move() round trip
+static long round_trip_promotions, round_trip_ep, round_trip_castlings;
+
+// dimensions of the test network, see src/nnue/nnue.c for the file format
+#define NET_FEATURES (64 * 12 * 64)
+#define NET_HIDDEN 256
+#define NET_L1 32
+
+// evaluations of the refreshing pass of nnue_walk(), compared in the incremental one
+static int *nnue_evaluations;
+static size_t nnue_evaluation_count;
+static size_t nnue_evaluation_capacity;
+static BoardSnapshot nnue_snapshot;
+
+static uint64_t next_random(void) {
+  cross_check_random ^= cross_check_random << 13;
+  cross_check_random ^= cross_check_random >> 7;
+  cross_check_random ^= cross_check_random << 17;
+  return cross_check_random;
+}
+
+static void cross_check_fail(char const *const what, MOVE const move) {
+  char fen[100];
 
-      if (GET_MOVE_EP(move_list.moves[i]))
-        perft_eps++;
+  board_to_fen(fen, sizeof(fen));
+  printf("%s failed :(\nposition %s, move 0x%x\n", what, fen, move);
+  exit(1);
+}
+
+static bool in_move_list(MoveList const *const move_list, MOVE const move) {
+  for (int i = 0; i < move_list->current_index; i++)
+    if ((move_list->moves[i] & 0xFFFFFF) == (move & 0xFFFFFF)) // without the check flag
+      return true;
+  return false;
+}
+
+static void cross_check_flush(void) {
+  int counts[BATCH_CAPACITY];
+
+  count_moves_batch(&cross_check_batch, counts);
+  for (int i = 0; i < cross_check_batch.count; i++)
+    if (counts[i] != cross_check_expected[i])
+      cross_check_fail("count_moves_batch()", 0);
+  batch_clear(&cross_check_batch);
+}
+
+/*
+ * Checks that the incremental key and evaluation terms match fresh
+ * ones, that every generated move survives compress_move() and
+ * expand_move() and that the move counting, checkmate and stalemate,
+ * check, legality and SEE functions agree with the generated move list.
+ */
+static void cross_check_node(MoveList const *const move_list) {
+  int const count = move_list->current_index;
+  bool const in_check = IS_KING_IN_CHECK(pos_side);
+
+  if (pos_key != compute_key())
+    cross_check_fail("the incremental key", 0);
+  EvalState eval;
+  compute_eval_state(&eval);
+  if (pos_eval.mg != eval.mg || pos_eval.eg != eval.eg || pos_eval.phase != eval.phase ||
+      pos_eval.material[WHITE] != eval.material[WHITE] || pos_eval.material[BLACK] != eval.material[BLACK] ||
+      pos_eval.signature != eval.signature)
+    cross_check_fail("the incremental evaluation", 0);
+  if (count_legal_moves() != count)
+    cross_check_fail("count_legal_moves()", 0);
+  if (has_legal_move() != (count > 0))
+    cross_check_fail("has_legal_move()", 0);
+  if (is_checkmate() != (count == 0 && in_check))
+    cross_check_fail("is_checkmate()", 0);
+  if (is_stalemate() != (count == 0 && !in_check))
+    cross_check_fail("is_stalemate()", 0);
+
+  if (cross_check_batch.count == BATCH_CAPACITY)
+    cross_check_flush();
+  cross_check_expected[batch_add_position(&cross_check_batch)] = count;
+
+  for (int i = 0; i < count; i++) {
+    MOVE const move = move_list->moves[i];
+
+    if (!is_legal(move))
+      cross_check_fail("is_legal() of a generated move", move);
+
+    // a MOVE16 has no room for the check flag
+    if (expand_move(compress_move(move)) != (move & 0xFFFFFF))
+      cross_check_fail("expand_move(compress_move())", move);
+    round_trip_promotions += GET_MOVE_PROMOTION(move) != 0;
+    round_trip_ep += GET_MOVE_EP(move) != 0;
+    round_trip_castlings += GET_MOVE_CASTLING(move) != 0;
+
+    make_move(move);
+    bool const checks = IS_KING_IN_CHECK(pos_side);
+    takeback();
+    if (gives_check(move) != checks)
+      cross_check_fail("gives_check()", move);
 
-      if (GET_MOVE_CASTLING(move_list.moves[i]))
-        perft_castles++;
+    int const value = see(move);
+    for (int threshold = value - 1; threshold <= value + 1; threshold++)
+      if (see_ge(move, threshold) != (value >= threshold))
+        cross_check_fail("see_ge()", move);
 
-      if (GET_MOVE_PROMOTION(move_list.moves[i]))
-        perft_promotions++;
+    // the move with one random bit flipped, below the check flag
+    MOVE const junk = move ^ (1U << (next_random() % 24));
+    if (is_legal(junk) && !in_move_list(move_list, junk))
+      cross_check_fail("is_legal() of a junk move", junk);
+    MOVE const random = cross_check_random >> 40;
+    if (is_legal(random) && !in_move_list(move_list, random))
+      cross_check_fail("is_legal() of a random move", random);
+  }
+}
+
+static void cross_check(int const depth) {
+  MoveList *const move_list = &move_stack[depth];
+
+  generate_moves_into(move_list);
+  cross_check_node(move_list);
+  if (depth == 0)
+    return;
+
+  for (int i = 0; i < move_list->current_index; i++) {
+    make_move(move_list->moves[i]);
+    cross_check(depth - 1);
+    takeback();
+  }
+}
+
+/*
+ * Writes a network of random weights small enough to keep the
+ * accumulators and layers away from clipping most of the time.
+ * @returns false if the file can't be written
+ */
+static bool write_test_network(FILE *const file) {
+  uint32_t const dimensions[3] = {NET_FEATURES, NET_HIDDEN, NET_L1};
+  int16_t row[2 * NET_HIDDEN];
+  int32_t wide[NET_L1];
+  bool ok = fwrite("SPKNNUE1", 8, 1, file) == 1 && fwrite(dimensions, sizeof(dimensions), 1, file) == 1;
+
+  for (int i = 0; i < NET_HIDDEN; i++)
+    row[i] = next_random() % 64;
+  ok = ok && fwrite(row, sizeof(int16_t), NET_HIDDEN, file) == NET_HIDDEN;
+  for (int feature = 0; feature < NET_FEATURES && ok; feature++) {
+    for (int i = 0; i < NET_HIDDEN; i++)
+      row[i] = (int) (next_random() % 17) - 8;
+    ok = fwrite(row, sizeof(int16_t), NET_HIDDEN, file) == NET_HIDDEN;
+  }
+  for (int i = 0; i < NET_L1; i++)
+    wide[i] = (int) (next_random() % 2000) - 1000;
+  ok = ok && fwrite(wide, sizeof(int32_t), NET_L1, file) == NET_L1;
+  for (int j = 0; j < NET_L1 && ok; j++) {
+    for (int i = 0; i < 2 * NET_HIDDEN; i++)
+      row[i] = (int) (next_random() % 41) - 20;
+    ok = fwrite(row, sizeof(int16_t), 2 * NET_HIDDEN, file) == 2 * NET_HIDDEN;
+  }
+  wide[0] = next_random() % 100;
+  for (int i = 0; i < NET_L1; i++)
+    row[i] = (int) (next_random() % 61) - 30;
+  return ok && fwrite(wide, sizeof(int32_t), 1, file) == 1 && fwrite(row, sizeof(int16_t), NET_L1, file) == NET_L1;
+}
+
+/*
+ * Evaluates about half of the nodes of the tree, the leaves always.
+ * With refresh, the board is restored from a snapshot before each
+ * evaluation, which recomputes the accumulators from scratch, and the
+ * result is recorded; otherwise the incremental result must match the
+ * recorded one. Both passes draw the same random numbers.
+ */
+static void nnue_walk(int const depth, bool const refresh) {
+  if (depth == 0 || next_random() % 2) {
+    if (refresh) {
+      board_snapshot(&nnue_snapshot);
+      board_restore(&nnue_snapshot);
+      if (nnue_evaluation_count == nnue_evaluation_capacity) {
+        nnue_evaluation_capacity = nnue_evaluation_capacity ? 2 * nnue_evaluation_capacity : 1 << 16;
+        nnue_evaluations = realloc(nnue_evaluations, nnue_evaluation_capacity * sizeof(int));
+        if (!nnue_evaluations)
+          cross_check_fail("allocating NNUE evaluations", 0);
+      }
+      nnue_evaluations[nnue_evaluation_count++] = nnue_evaluate();
+    } else if (nnue_evaluate() != nnue_evaluations[nnue_evaluation_count++]) {
+      cross_check_fail("the incremental NNUE accumulator", 0);
     }
+  }
+  if (depth == 0)
+    return;
 
-    make_move(move_list.moves[i]);
-    nodes += perft(depth - 1);
+  MoveList *const move_list = &move_stack[depth];
+  generate_moves_into(move_list);
+  for (int i = 0; i < move_list->current_index; i++) {
+    make_move(move_list->moves[i]);
+    nnue_walk(depth - 1, refresh);
     takeback();
   }
-  return nodes;
 }
 
+/*
+ * Compares the NNUE evaluations of the perft trees, with the
+ * accumulators updated move by move, against full refreshes. The
+ * network is random, written to a temporary file.
+ */
+static void nnue_cross_check(int const depth) {
+  char path[] = "/tmp/spark-net-XXXXXX";
+  int const fd = mkstemp(path);
+  FILE *const file = fd < 0 ? NULL : fdopen(fd, "wb");
+  bool const written = file && write_test_network(file);
+
+  if (file)
+    fclose(file);
+  bool const loaded = written && nnue_load(path) == 0 && nnue_enable(true);
+  if (fd >= 0)
+    unlink(path);
+  if (!loaded)
+    cross_check_fail("loading the test network", 0);
+
+  int pos_count = sizeof(pos_list) / sizeof(pos_list[0]);
+  for (int i = 0; i < pos_count; i++) {
+    uint64_t const seed = cross_check_random;
+    nnue_evaluation_count = 0;
+    parse_fen(pos_list[i].pos);
+    nnue_walk(depth, true);
+
+    cross_check_random = seed;
+    nnue_evaluation_count = 0;
+    parse_fen(pos_list[i].pos);
+    nnue_walk(depth, false);
+  }
+  nnue_enable(false);
+  free(nnue_evaluations);
+  nnue_evaluations = NULL;
+  nnue_evaluation_capacity = 0;
+}
+
+/*
+ * Walks the perft trees of the suite positions, cross-checking the
+ * board queries at every node, see cross_check_node().
+ */
+void perft_cross_check_suite(int const depth) {
+
+  printf("\n--> Running perft cross-checks\n");
+
+  batch_clear(&cross_check_batch);
+  int pos_count = sizeof(pos_list) / sizeof(pos_list[0]);
+  for (int i = 0; i < pos_count; i++) {
+    printf("\n[ %s ]\n", pos_list[i].title);
+    parse_fen(pos_list[i].pos);
+    printf("depth %d: ", depth);
+    fflush(stdout);
+    cross_check(depth);
+    printf("success :)\n");
+  }
+  cross_check_flush();
+  if (!round_trip_promotions || !round_trip_ep || !round_trip_castlings)
+    cross_check_fail("covering promotions, en passant and castling", 0);
+
+  printf("\n[ NNUE ]\n");
+  nnue_cross_check(depth);
+  printf("success :)\n");
+
+  printf("\nAll cross-checks passed!\n");
+}
+
+/*
+ * Maps a checkpoint file, creating it if needed.
+ * @returns 0 on success, -1 on error or if the file exists
+ *          but is not a checkpoint file
+ */
+int perft_checkpoint_open(PerftCheckpoint *const checkpoint, char const *const path) {
+  checkpoint->file = NULL;
+
+  int const fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    return -1;
 
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (st.st_size != 0 && (size_t) st.st_size != sizeof(PerftCheckpointFile)) ||
+      ftruncate(fd, sizeof(PerftCheckpointFile)) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  PerftCheckpointFile *const file = mmap(NULL, sizeof(PerftCheckpointFile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd); // the mapping stays valid
+  if (file == MAP_FAILED)
+    return -1;
+
+  if (st.st_size == 0) {
+    file->magic = CHECKPOINT_MAGIC;
+  } else if (file->magic != CHECKPOINT_MAGIC) {
+    munmap(file, sizeof(PerftCheckpointFile));
+    return -1;
+  }
+  checkpoint->file = file;
+  return 0;
+}
+
+void perft_checkpoint_close(PerftCheckpoint *const checkpoint) {
+  if (checkpoint->file) {
+    msync(checkpoint->file, sizeof(PerftCheckpointFile), MS_SYNC);
+    munmap(checkpoint->file, sizeof(PerftCheckpointFile));
+  }
+  checkpoint->file = NULL;
+}
+
+/*
+ * FNV-1a hash of the packed position and the depth. The clocks
+ * are left out, as they don't change the move tree.
+ */
+static uint64_t checkpoint_key(int const depth) {
+  PackedPosition record;
+  pack_position(&record);
+  record.halfmove = 0;
+  record.fullmove = 1;
+
+  uint64_t hash = 0xCBF29CE484222325ULL ^ (uint64_t) depth;
+  unsigned char const *const bytes = (unsigned char const *) &record;
+  for (size_t i = 0; i < sizeof(record); i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001B3ULL;
+  }
+  return hash ? hash : 1;
+}
+
+/*
+ * Finds the entry of a position and depth, checking that the root
+ * moves are unchanged. Otherwise a free slot is claimed, or the home
+ * slot of the key is overwritten when the file is full.
+ */
+static PerftCheckpointEntry *checkpoint_entry(PerftCheckpointFile *const file, uint64_t const key,
+                                              int const depth, MoveList const *const roots) {
+  PerftCheckpointEntry *entry = NULL;
+
+  for (int i = 0; i < PERFT_CHECKPOINT_SLOTS; i++) {
+    PerftCheckpointEntry *const slot = &file->entries[(key + i) % PERFT_CHECKPOINT_SLOTS];
+    if (slot->key == key && slot->depth == (uint32_t) depth &&
+        slot->move_count == (uint32_t) roots->current_index &&
+        !memcmp(slot->moves, roots->moves, roots->current_index * sizeof(MOVE)))
+      return slot;
+    if (!slot->key && !entry)
+      entry = slot;
+  }
+  if (!entry)
+    entry = &file->entries[key % PERFT_CHECKPOINT_SLOTS];
+
+  memset(entry, 0, sizeof(*entry));
+  entry->depth = depth;
+  entry->move_count = roots->current_index;
+  memcpy(entry->moves, roots->moves, roots->current_index * sizeof(MOVE));
+  entry->key = key; // claimed last, so a half written entry is never matched
+  return entry;
+}
+
+/*
+ * Like perft(), saving the subtotal of every root move to the
+ * checkpoint as soon as it is complete. Root moves found done
+ * in the checkpoint are not searched again. The mapping is
+ * shared, so the subtotals survive the process being killed.
+ * @returns 0 if depth is outside [0, MAX_PERFT_DEPTH], like perft()
+ */
+BB perft_checkpointed(int const depth, PerftCheckpoint *const checkpoint) {
+
+  if (depth <= 1 || depth > MAX_PERFT_DEPTH || !checkpoint->file)
+    return perft(depth);
+
+  MoveList *const roots = &move_stack[depth];
+  generate_moves_into(roots);
+
+  PerftCheckpointEntry *const entry = checkpoint_entry(checkpoint->file, checkpoint_key(depth), depth, roots);
+  BB nodes = 0;
+
+  for (int i = 0; i < roots->current_index; i++) {
+    if (!entry->done[i]) {
+      make_move(roots->moves[i]);
+      entry->nodes[i] = perft(depth - 1);
+      takeback();
+      entry->done[i] = 1; // set after the subtotal
+      msync(checkpoint->file, sizeof(PerftCheckpointFile), MS_ASYNC);
+    }
+    nodes += entry->nodes[i];
+  }
+  return nodes;
+}
@@ -1,11 +1,66 @@
 #ifndef PERFT_H
 #define PERFT_H
+#include <stdint.h>
 #include "../Types.h"
 
+#define PERFT_MAX_WORKERS 1024 // for perft_distributed()
+
+/**
+ * @brief Leaf statistics of a perft run
+ */
+typedef struct PerftStats {
+  BB nodes;
+  BB captures;
+  BB eps;
+  BB castles;
+  BB promotions;
+  BB checks;
+  BB discovered_checks;
+  BB double_checks;
+  BB checkmates;
+} PerftStats;
+
+#define PERFT_CHECKPOINT_SLOTS 64
+
+/**
+ * @brief Completed root move subtotals of one position and depth
+ */
+typedef struct PerftCheckpointEntry {
+  uint64_t key; // 0 for a free slot
+  uint32_t depth;
+  uint32_t move_count;
+  MOVE moves[256];
+  BB nodes[256];
+  uint8_t done[256];
+} PerftCheckpointEntry;
+
+/**
+ * @brief Layout of a checkpoint file
+ */
+typedef struct PerftCheckpointFile {
+  uint64_t magic;
+  PerftCheckpointEntry entries[PERFT_CHECKPOINT_SLOTS];
+} PerftCheckpointFile;
+
+typedef struct PerftCheckpoint {
+  PerftCheckpointFile *file;
+} PerftCheckpoint;
+
 void divide(int depth);
 void run_perft(int depth);
-BB perft(int depth);
 void perft_suite(int max_depth);
 void benchmark(void);
+bool perft_detailed(int depth, PerftStats *stats);
+void perft_stats_suite(void);
+void perft_cross_check_suite(int depth);
+void fen_suite(void);
+void polyglot_suite(void);
+void draw_suite(void);
+void playout_suite(void);
+void print_perft_stats(PerftStats const *stats);
+int perft_checkpoint_open(PerftCheckpoint *checkpoint, char const *path);
+void perft_checkpoint_close(PerftCheckpoint *checkpoint);
+BB perft_checkpointed(int depth, PerftCheckpoint *checkpoint);
+BB perft_distributed(int depth, int worker_count);
 
 #endif
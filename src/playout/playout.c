@@ -0,0 +1,156 @@
+#include "../board/board.h"
+#include "../board_utils/board_utils.h"
+#include "../move_encoding/move_encoding.h"
+#include "../generator/generator.h"
+#include "playout.h"
+
+/*
+ * Random playouts: games are played from a start position with
+ * uniformly or weighted random legal moves until they end by mate,
+ * stalemate, the fifty-move rule, insufficient material, threefold
+ * repetition or the ply limit. Each position reached can be written as a PackedPosition.
+ *
+ * The generator state (xoshiro256**) is owned by the caller, so
+ * every thread keeps its own and no state is shared.
+ */
+
+static int move_weight(MOVE move);
+static MOVE pick_move(MoveList const *list, PlayoutRng *rng, bool weighted);
+
+static inline uint64_t rotl(uint64_t const x, int const k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+/*
+ * Seeds all four state words through splitmix64, which never
+ * leaves the state all zero.
+ */
+void playout_seed(PlayoutRng *const rng, uint64_t seed) {
+  for (int i = 0; i < 4; i++) {
+    uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    rng->s[i] = z ^ (z >> 31);
+  }
+}
+
+uint64_t playout_random(PlayoutRng *const rng) {
+  uint64_t *const s = rng->s;
+  uint64_t const result = rotl(s[1] * 5, 7) * 9;
+  uint64_t const t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+  return result;
+}
+
+/*
+ * Weighted playouts favour forcing moves: captures, queen
+ * promotions and checks.
+ */
+static int move_weight(MOVE const move) {
+  int weight = 1;
+  int const promotion = GET_MOVE_PROMOTION(move);
+
+  if (GET_MOVE_CAPTURE(move))
+    weight += 3;
+  if (promotion == Q || promotion == q)
+    weight += 6;
+  if (GET_MOVE_CHECK(move))
+    weight += 3;
+  return weight;
+}
+
+static MOVE pick_move(MoveList const *const list, PlayoutRng *const rng, bool const weighted) {
+  int const count = list->current_index;
+
+  if (!weighted) // bounded random number without division
+    return list->moves[((playout_random(rng) >> 32) * (uint64_t) count) >> 32];
+
+  int total = 0;
+  for (int i = 0; i < count; i++)
+    total += move_weight(list->moves[i]);
+
+  int pick = ((playout_random(rng) >> 32) * (uint64_t) total) >> 32;
+  for (int i = 0; i < count - 1; i++) {
+    pick -= move_weight(list->moves[i]);
+    if (pick < 0)
+      return list->moves[i];
+  }
+  return list->moves[count - 1];
+}
+
+/*
+ * Plays one game from fen. Weighted games need check flags, see
+ * set_check_flags().
+ * @param out Receives every position of the game, may be NULL
+ * @returns One of PLAYOUT_CHECKMATE .. PLAYOUT_PLY_LIMIT, -1 if
+ *          load_fen() rejects fen. The final position is left on
+ *          the board.
+ */
+int play_random_game(char const *const fen, PlayoutRng *const rng, bool const weighted, PositionWriter *const out) {
+  MoveList list;
+  PackedPosition record;
+
+  if (!load_fen(fen))
+    return -1;
+
+  while (1) {
+    if (out && pack_position(&record))
+      position_writer_add(out, &record);
+
+    generate_moves_into(&list);
+    if (list.current_index == 0)
+      return IS_KING_IN_CHECK(pos_side) ? PLAYOUT_CHECKMATE : PLAYOUT_STALEMATE;
+    if (pos_halfmove >= 100)
+      return PLAYOUT_FIFTY_MOVES;
+    if (is_insufficient_material())
+      return PLAYOUT_INSUFFICIENT_MATERIAL;
+    if (is_threefold_repetition())
+      return PLAYOUT_REPETITION;
+    if (pos_moves.index >= PLAYOUT_MAX_PLIES)
+      return PLAYOUT_PLY_LIMIT;
+
+    make_move(pick_move(&list, rng, weighted));
+  }
+}
+
+/*
+ * Plays games from the start positions in turn. Check flags are
+ * enabled for weighted games and disabled again afterwards.
+ * @returns false if a start position is rejected, stats then hold
+ *          the games played before it
+ */
+bool run_playouts(char *const *const fens, int const fen_count, uint64_t const games, uint64_t const seed,
+                  bool const weighted, PositionWriter *const out, PlayoutStats *const stats) {
+  PlayoutRng rng;
+
+  playout_seed(&rng, seed);
+  *stats = (PlayoutStats) {0};
+  if (weighted)
+    set_check_flags(true);
+
+  for (uint64_t game = 0; game < games; game++) {
+    int const result = play_random_game(fens[game % fen_count], &rng, weighted, out);
+
+    if (result < 0)
+      break;
+    stats->games++;
+    stats->plies += pos_moves.index;
+    stats->results[result]++;
+    if (result == PLAYOUT_CHECKMATE) {
+      if (pos_side == WHITE)
+        stats->black_wins++;
+      else
+        stats->white_wins++;
+    }
+  }
+
+  if (weighted)
+    set_check_flags(false);
+  return stats->games == games;
+}
@@ -0,0 +1,38 @@
+#ifndef SPARK_PLAYOUT_H
+#define SPARK_PLAYOUT_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "../packed_position/packed_position.h"
+
+// games are cut off before the move stacks of the board overflow
+#define PLAYOUT_MAX_PLIES 900
+
+enum {
+  PLAYOUT_CHECKMATE,
+  PLAYOUT_STALEMATE,
+  PLAYOUT_FIFTY_MOVES,
+  PLAYOUT_INSUFFICIENT_MATERIAL,
+  PLAYOUT_REPETITION,
+  PLAYOUT_PLY_LIMIT,
+  PLAYOUT_RESULTS
+};
+
+typedef struct PlayoutRng {
+  uint64_t s[4];
+} PlayoutRng;
+
+typedef struct PlayoutStats {
+  uint64_t games;
+  uint64_t plies;
+  uint64_t white_wins;
+  uint64_t black_wins;
+  uint64_t results[PLAYOUT_RESULTS];
+} PlayoutStats;
+
+void playout_seed(PlayoutRng *rng, uint64_t seed);
+uint64_t playout_random(PlayoutRng *rng);
+int play_random_game(char const *fen, PlayoutRng *rng, bool weighted, PositionWriter *out);
+bool run_playouts(char *const *fens, int fen_count, uint64_t games, uint64_t seed,
+                  bool weighted, PositionWriter *out, PlayoutStats *stats);
+
+#endif
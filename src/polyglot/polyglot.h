@@ -0,0 +1,29 @@
+#ifndef SPARK_POLYGLOT_H
+#define SPARK_POLYGLOT_H
+#include <stddef.h>
+#include <stdint.h>
+#include "../Types.h"
+
+#define POLYGLOT_KEY_COUNT 781
+#define POLYGLOT_ENTRY_SIZE 16
+
+typedef struct PolyglotBook {
+  uint8_t const *entries; // big-endian, sorted by key
+  size_t count;
+  size_t map_size;
+} PolyglotBook;
+
+typedef struct BookMove {
+  MOVE move;
+  uint16_t weight;
+} BookMove;
+
+void polyglot_set_keys(BB const keys[POLYGLOT_KEY_COUNT]);
+BB polyglot_key(void);
+
+int polyglot_open(PolyglotBook *book, char const *path);
+void polyglot_close(PolyglotBook *book);
+int polyglot_probe(PolyglotBook const *book, BookMove *out, int max);
+MOVE polyglot_pick(PolyglotBook const *book, uint64_t random);
+
+#endif
@@ -0,0 +1,526 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../board/board.h"
+#include "../board_utils/board_utils.h"
+#include "../move_encoding/move_encoding.h"
+#include "../generator/generator.h"
+#include "../see/see.h"
+#include "../eval/eval.h"
+#include "search.h"
+
+/*
+ * Alpha-beta search: iterative deepening over a principal variation
+ * search, with a transposition table, null move pruning, a check
+ * extension and a quiescence search over captures that don't lose
+ * material (see_ge()). Moves are ordered by the table move, captures
+ * (as sorted by the generator), killers and the history table.
+ *
+ * With several threads (Lazy SMP), helper threads search the same
+ * root on copies of the board, each skipping different depths, and
+ * share only the transposition table. The table is lock-free: an
+ * entry stores key ^ data next to data, so an entry torn by
+ * concurrent writes fails verification and reads as a miss.
+ *
+ * The search runs on the calling thread's board and leaves it as it
+ * found it.
+ */
+
+#define DEFAULT_HASH_MB 16
+#define CHECK_INTERVAL 4095 // nodes between clock checks, plus one
+#define NULL_MOVE_MIN_DEPTH 3
+#define MATE_BOUND (SEARCH_MATE - SEARCH_MAX_PLY)
+#define MAX_THREADS 256
+
+enum { BOUND_UPPER = 1, BOUND_LOWER = 2, BOUND_EXACT = 3 };
+
+// data: move in bits 0-31, score 32-47, depth 48-55, bound 56-63
+typedef struct TTEntry {
+  _Atomic BB check; // key ^ data
+  _Atomic BB data;
+} TTEntry;
+
+_Static_assert(sizeof(TTEntry) == 16, "TTEntry must be 16 bytes");
+
+typedef struct TTData {
+  MOVE move;
+  int score;
+  int depth;
+  int bound;
+} TTData;
+
+typedef struct SearchThread {
+  pthread_t handle;
+  int id;
+  int max_depth;
+  SearchLimits const *limits;
+  SearchResult result;
+} SearchThread;
+
+// helper threads skip some iterations, to spread them over more depths
+static const int skip_size[] = {1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4};
+static const int skip_phase[] = {0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7};
+
+// shared by all threads
+static TTEntry *tt;
+static size_t tt_mask;
+static int thread_count = 1;
+static BoardSnapshot root_board;
+static int64_t start_time;
+static uint64_t node_limit;
+static int64_t deadline; // ms on the monotonic clock, 0 for none
+static atomic_bool stopped;
+static _Atomic uint64_t shared_nodes; // node counts, as flushed by the threads
+
+// per thread
+static _Thread_local MoveList move_lists[SEARCH_MAX_PLY + 1];
+static _Thread_local int move_scores[SEARCH_MAX_PLY + 1][256];
+static _Thread_local MOVE killers[SEARCH_MAX_PLY + 1][2];
+static _Thread_local int history[12][64];
+static _Thread_local MOVE pv_table[SEARCH_MAX_PLY + 1][SEARCH_MAX_PLY + 1];
+static _Thread_local int pv_length[SEARCH_MAX_PLY + 1];
+static _Thread_local uint64_t nodes;
+static _Thread_local uint64_t flushed_nodes; // part of nodes added to shared_nodes
+
+static int64_t now_ms(void);
+static bool tt_init(size_t megabytes);
+static bool tt_probe(TTData *out);
+static void tt_store(MOVE move, int score, int depth, int bound, int ply);
+static bool check_limits(void);
+static void score_moves(MoveList const *list, int *scores, MOVE tt_move, int ply);
+static MOVE next_move(MoveList *list, int *scores, int index);
+static void update_quiet(MOVE move, int depth, int ply);
+static int quiescence(int alpha, int beta, int ply);
+static int negamax(int alpha, int beta, int depth, int ply, bool null_allowed);
+static void iterate(SearchThread *thread);
+static void *helper_main(void *arg);
+
+static int64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Allocates the largest power of two number of entries that fits.
+ */
+static bool tt_init(size_t const megabytes) {
+  size_t entries = 1;
+  while (2 * entries * sizeof(TTEntry) <= megabytes << 20)
+    entries *= 2;
+
+  TTEntry *const table = calloc(entries, sizeof(TTEntry));
+  if (!table)
+    return false;
+  free(tt);
+  tt = table;
+  tt_mask = entries - 1;
+  return true;
+}
+
+/*
+ * @returns false if the table holds no (intact) entry for the position
+ */
+static bool tt_probe(TTData *const out) {
+  TTEntry *const entry = &tt[pos_key & tt_mask];
+  BB const data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+  BB const check = atomic_load_explicit(&entry->check, memory_order_relaxed);
+
+  if ((check ^ data) != pos_key)
+    return false;
+  out->move = (MOVE) data;
+  out->score = (int16_t) (data >> 32);
+  out->depth = (int8_t) (data >> 48);
+  out->bound = data >> 56;
+  return true;
+}
+
+/*
+ * Always replaces, except that a result without a move keeps the
+ * move of an earlier result for the same position.
+ * Mate scores are stored relative to the node.
+ */
+static void tt_store(MOVE move, int score, int const depth, int const bound, int const ply) {
+  TTEntry *const entry = &tt[pos_key & tt_mask];
+  TTData previous;
+
+  if (score > MATE_BOUND)
+    score += ply;
+  else if (score < -MATE_BOUND)
+    score -= ply;
+  if (!move && tt_probe(&previous))
+    move = previous.move;
+
+  BB const data = move | (BB) (uint16_t) score << 32 | (BB) (uint8_t) depth << 48 | (BB) bound << 56;
+  atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+  atomic_store_explicit(&entry->check, pos_key ^ data, memory_order_relaxed);
+}
+
+static bool check_limits(void) {
+  if ((nodes & CHECK_INTERVAL) == 0) {
+    atomic_fetch_add_explicit(&shared_nodes, nodes - flushed_nodes, memory_order_relaxed);
+    flushed_nodes = nodes;
+    if (deadline && now_ms() >= deadline)
+      stopped = true;
+  }
+  if (node_limit && atomic_load_explicit(&shared_nodes, memory_order_relaxed) + nodes - flushed_nodes >= node_limit)
+    stopped = true;
+  return stopped;
+}
+
+static void score_moves(MoveList const *const list, int *const scores, MOVE const tt_move, int const ply) {
+  for (int i = 0; i < list->current_index; i++) {
+    MOVE const move = list->moves[i];
+
+    if (move == tt_move)
+      scores[i] = 1 << 30;
+    else if (i < list->capture_count)
+      scores[i] = (1 << 28) - i; // keep the generator's order
+    else if (move == killers[ply][0])
+      scores[i] = (1 << 27) + 1;
+    else if (move == killers[ply][1])
+      scores[i] = 1 << 27;
+    else
+      scores[i] = history[GET_MOVE_PIECE(move)][GET_MOVE_TARGET(move)];
+  }
+}
+
+/*
+ * Selection sort step: moves the best scored of the remaining
+ * moves to index.
+ */
+static MOVE next_move(MoveList *const list, int *const scores, int const index) {
+  int best = index;
+
+  for (int i = index + 1; i < list->current_index; i++)
+    if (scores[i] > scores[best])
+      best = i;
+
+  MOVE const move = list->moves[best];
+  int const score = scores[best];
+  list->moves[best] = list->moves[index];
+  scores[best] = scores[index];
+  list->moves[index] = move;
+  scores[index] = score;
+  return move;
+}
+
+static void update_quiet(MOVE const move, int const depth, int const ply) {
+  if (killers[ply][0] != move) {
+    killers[ply][1] = killers[ply][0];
+    killers[ply][0] = move;
+  }
+
+  int *const entry = &history[GET_MOVE_PIECE(move)][GET_MOVE_TARGET(move)];
+  *entry += depth * depth;
+  if (*entry > 1 << 20) // keep history below the killers
+    for (int piece = P; piece <= k; piece++)
+      for (int square = 0; square < 64; square++)
+        history[piece][square] /= 2;
+}
+
+/*
+ * Searches captures and promotions until the position is quiet.
+ * In check, all evasions are searched instead.
+ */
+static int quiescence(int alpha, int const beta, int const ply) {
+  nodes++;
+  if (check_limits())
+    return 0;
+
+  bool const in_check = IS_KING_IN_CHECK(pos_side);
+  if (ply >= SEARCH_MAX_PLY)
+    return evaluate();
+
+  if (!in_check) {
+    int const stand_pat = evaluate();
+    if (stand_pat >= beta)
+      return stand_pat;
+    if (stand_pat > alpha)
+      alpha = stand_pat;
+  }
+
+  MoveList *const list = &move_lists[ply];
+  generate_moves_into(list);
+  if (in_check && list->current_index == 0)
+    return -SEARCH_MATE + ply;
+
+  int const count = in_check ? list->current_index : list->capture_count;
+  for (int i = 0; i < count; i++) {
+    MOVE const move = list->moves[i];
+    if (!in_check && !GET_MOVE_PROMOTION(move) && !see_ge(move, 0))
+      continue;
+
+    make_move(move);
+    int const score = -quiescence(-beta, -alpha, ply + 1);
+    takeback();
+
+    if (stopped)
+      return 0;
+    if (score >= beta)
+      return score;
+    if (score > alpha)
+      alpha = score;
+  }
+  return alpha;
+}
+
+static int negamax(int alpha, int const beta, int depth, int const ply, bool const null_allowed) {
+  bool const pv_node = beta - alpha > 1;
+  pv_length[ply] = ply;
+
+  if (ply > 0 && (pos_halfmove >= 100 || is_repetition()))
+    return 0;
+
+  bool const in_check = IS_KING_IN_CHECK(pos_side);
+  if (in_check)
+    depth++;
+  if (depth <= 0 || ply >= SEARCH_MAX_PLY)
+    return quiescence(alpha, beta, ply);
+
+  nodes++;
+  if (check_limits())
+    return 0;
+
+  TTData entry;
+  MOVE tt_move = 0;
+  if (tt_probe(&entry)) {
+    tt_move = entry.move;
+    int score = entry.score;
+    if (score > MATE_BOUND)
+      score -= ply;
+    else if (score < -MATE_BOUND)
+      score += ply;
+
+    if (ply > 0 && !pv_node && entry.depth >= depth &&
+        ((entry.bound == BOUND_EXACT) ||
+         (entry.bound == BOUND_LOWER && score >= beta) ||
+         (entry.bound == BOUND_UPPER && score <= alpha)))
+      return score;
+  }
+
+  // null move: if passing still fails high, so will a real move
+  BB const pieces = pos_occupancies[pos_side] & ~pos_pieces[pos_side == WHITE ? P : p] &
+                    ~pos_pieces[pos_side == WHITE ? K : k];
+  if (null_allowed && !pv_node && !in_check && depth >= NULL_MOVE_MIN_DEPTH && pieces &&
+      beta < MATE_BOUND && evaluate() >= beta) {
+    int const reduction = depth > 6 ? 3 : 2;
+    make_null_move();
+    int const score = -negamax(-beta, -beta + 1, depth - 1 - reduction, ply + 1, false);
+    takeback_null_move();
+    if (stopped)
+      return 0;
+    if (score >= beta)
+      return score >= MATE_BOUND ? beta : score;
+  }
+
+  MoveList *const list = &move_lists[ply];
+  int *const scores = move_scores[ply];
+  int const original_alpha = alpha;
+  int best_score = -SEARCH_INFINITY;
+  MOVE best_move = 0;
+  int searched = 0;
+
+  // the hash move may come from another position with the same slot,
+  // it is checked on its own and searched before the other moves are
+  // generated, which a cutoff makes unnecessary
+  if (tt_move && !is_legal(tt_move))
+    tt_move = 0;
+
+  for (int i = tt_move ? -1 : 0;; i++) {
+    MOVE move = tt_move;
+    int score;
+
+    if (i == 0) {
+      generate_moves_into(list);
+      if (list->current_index == 0)
+        return in_check ? -SEARCH_MATE + ply : 0;
+      score_moves(list, scores, tt_move, ply);
+    }
+    if (i >= list->current_index)
+      break;
+    if (i >= 0) {
+      move = next_move(list, scores, i);
+      if (move == tt_move)
+        continue;
+    }
+
+    make_move(move);
+    if (searched++ == 0) {
+      score = -negamax(-beta, -alpha, depth - 1, ply + 1, true);
+    } else {
+      score = -negamax(-alpha - 1, -alpha, depth - 1, ply + 1, true);
+      if (score > alpha && score < beta)
+        score = -negamax(-beta, -alpha, depth - 1, ply + 1, true);
+    }
+    takeback();
+
+    if (stopped)
+      return 0;
+    if (score <= best_score)
+      continue;
+
+    best_score = score;
+    best_move = move;
+    if (score > alpha) {
+      alpha = score;
+      pv_table[ply][ply] = move;
+      memcpy(&pv_table[ply][ply + 1], &pv_table[ply + 1][ply + 1],
+             (pv_length[ply + 1] - ply - 1) * sizeof(MOVE));
+      pv_length[ply] = pv_length[ply + 1] > ply + 1 ? pv_length[ply + 1] : ply + 1;
+    }
+    if (score >= beta) {
+      if (!GET_MOVE_CAPTURE(move) && !GET_MOVE_PROMOTION(move))
+        update_quiet(move, depth, ply);
+      break;
+    }
+  }
+
+  int const bound = best_score >= beta ? BOUND_LOWER : best_score > original_alpha ? BOUND_EXACT : BOUND_UPPER;
+  tt_store(best_move, best_score, depth, bound, ply);
+  return best_score;
+}
+
+/*
+ * Iterative deepening on the calling thread's board. Only completed
+ * iterations go into thread->result, and only the main thread
+ * (id 0) reports them and decides when to stop.
+ */
+static void iterate(SearchThread *const thread) {
+  SearchLimits const *const limits = thread->limits;
+  SearchResult *const result = &thread->result;
+
+  nodes = 0;
+  flushed_nodes = 0;
+  memset(killers, 0, sizeof(killers));
+
+  for (int depth = 1; depth <= thread->max_depth; depth++) {
+    if (thread->id > 0) {
+      int const i = (thread->id - 1) % (int) (sizeof(skip_size) / sizeof(skip_size[0]));
+      if (((depth + skip_phase[i]) / skip_size[i]) % 2)
+        continue;
+    }
+
+    int const score = negamax(-SEARCH_INFINITY, SEARCH_INFINITY, depth, 0, true);
+    if (stopped)
+      break;
+
+    result->best_move = pv_table[0][0];
+    result->score = score;
+    result->depth = depth;
+    result->pv_length = pv_length[0];
+    memcpy(result->pv, pv_table[0], pv_length[0] * sizeof(MOVE));
+    if (thread->id > 0)
+      continue;
+
+    result->nodes = atomic_load(&shared_nodes) + nodes - flushed_nodes;
+    result->time_ms = now_ms() - start_time;
+    if (limits->report)
+      limits->report(result);
+
+    // another iteration takes longer than all the previous ones
+    if (deadline && now_ms() - start_time > limits->time_ms / 2)
+      break;
+    if (score > MATE_BOUND || score < -MATE_BOUND)
+      break;
+  }
+  atomic_fetch_add(&shared_nodes, nodes - flushed_nodes);
+  flushed_nodes = nodes;
+}
+
+static void *helper_main(void *const arg) {
+  board_restore(&root_board);
+  iterate(arg);
+  return NULL;
+}
+
+/*
+ * Searches the current position by iterative deepening until one of
+ * the limits is reached or search_stop() is called, on as many
+ * threads as set with search_set_threads(). The result is that of
+ * the thread with the deepest completed iteration.
+ * @returns The best move, 0 if there is no legal move
+ */
+MOVE search(SearchLimits const *const limits, SearchResult *const result) {
+  static SearchThread threads[MAX_THREADS];
+
+  start_time = now_ms();
+  if (!tt && !tt_init(DEFAULT_HASH_MB))
+    return 0;
+
+  *result = (SearchResult) {0};
+  node_limit = limits->nodes;
+  deadline = limits->time_ms > 0 ? start_time + limits->time_ms : 0;
+  stopped = false;
+  shared_nodes = 0;
+
+  MoveList roots;
+  generate_moves_into(&roots);
+  if (roots.current_index == 0)
+    return 0;
+
+  int const max_depth = limits->depth > 0 && limits->depth < SEARCH_MAX_PLY ? limits->depth : SEARCH_MAX_PLY;
+  for (int i = 0; i < thread_count; i++) {
+    threads[i] = (SearchThread) {.id = i, .max_depth = max_depth, .limits = limits};
+    threads[i].result.best_move = roots.moves[0]; // in case not even depth 1 completes
+  }
+
+  int started = 1;
+  board_snapshot(&root_board);
+  for (; started < thread_count; started++)
+    if (pthread_create(&threads[started].handle, NULL, helper_main, &threads[started]))
+      break; // search with the threads there are
+
+  iterate(&threads[0]);
+  stopped = true;
+  for (int i = 1; i < started; i++)
+    pthread_join(threads[i].handle, NULL);
+
+  SearchThread const *best = &threads[0];
+  for (int i = 1; i < started; i++)
+    if (threads[i].result.depth > best->result.depth)
+      best = &threads[i];
+
+  *result = best->result;
+  result->nodes = shared_nodes;
+  result->time_ms = now_ms() - start_time;
+  return result->best_move;
+}
+
+void search_stop(void) {
+  stopped = true;
+}
+
+/*
+ * Forgets everything learned from previous searches, e.g. for a
+ * new game.
+ */
+void search_clear(void) {
+  if (tt)
+    memset(tt, 0, (tt_mask + 1) * sizeof(TTEntry));
+  memset(killers, 0, sizeof(killers));
+  memset(history, 0, sizeof(history));
+}
+
+/*
+ * Sets the number of threads of the following searches, the calling
+ * thread included.
+ * @returns 0 on success, -1 if count is out of range
+ */
+int search_set_threads(int const count) {
+  if (count < 1 || count > MAX_THREADS)
+    return -1;
+  thread_count = count;
+  return 0;
+}
+
+/*
+ * Resizes (and clears) the transposition table.
+ * @returns 0 on success, -1 if the memory can't be allocated
+ */
+int search_set_hash(int const megabytes) {
+  return megabytes > 0 && tt_init(megabytes) ? 0 : -1;
+}
@@ -0,0 +1,35 @@
+#ifndef SPARK_SEARCH_H
+#define SPARK_SEARCH_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "../Types.h"
+
+#define SEARCH_MAX_PLY 64
+#define SEARCH_INFINITY 32000
+#define SEARCH_MATE 31000 // mate in n plies scores SEARCH_MATE - n
+
+typedef struct SearchResult {
+  MOVE best_move;
+  int score;
+  int depth;
+  uint64_t nodes;
+  int64_t time_ms;
+  MOVE pv[SEARCH_MAX_PLY];
+  int pv_length;
+} SearchResult;
+
+// zero means no limit
+typedef struct SearchLimits {
+  int depth;
+  uint64_t nodes;
+  int64_t time_ms;
+  void (*report)(SearchResult const *result); // called after every iteration, may be NULL
+} SearchLimits;
+
+MOVE search(SearchLimits const *limits, SearchResult *result);
+void search_stop(void);
+void search_clear(void);
+int search_set_hash(int megabytes);
+int search_set_threads(int count);
+
+#endif
@@ -0,0 +1,162 @@
+#include "../attack_tables/attack_tables.h"
+#include "../board_utils/board_utils.h"
+#include "../board/board.h"
+#include "../move_encoding/move_encoding.h"
+#include "see.h"
+
+/*
+ * Static exchange evaluation: resolves the sequence of captures on
+ * the target square of a move, each side always recapturing with its
+ * least valuable attacker. Sliders hidden behind a capturing piece
+ * are discovered by recomputing the slider attacks on the target
+ * with the updated occupancy. Pins are not taken into account.
+ */
+
+static const int see_values[] = {
+  [P] = 100, [p] = 100,
+  [N] = 300, [n] = 300,
+  [B] = 300, [b] = 300,
+  [R] = 500, [r] = 500,
+  [Q] = 900, [q] = 900,
+  [K] = 20000, [k] = 20000
+};
+
+static int captured_value(MOVE move);
+static BB least_valuable(BB attackers, int side, int *piece);
+
+static int captured_value(MOVE const move) {
+  int value = 0;
+
+  if (GET_MOVE_EP(move))
+    value = see_values[P];
+  else if (GET_MOVE_CAPTURE(move))
+    value = see_values[pos_occupancy[GET_MOVE_TARGET(move)]];
+
+  if (GET_MOVE_PROMOTION(move))
+    value += see_values[GET_MOVE_PROMOTION(move)] - see_values[P];
+
+  return value;
+}
+
+/*
+ * Returns the square of side's least valuable piece in attackers
+ * as a bitboard, and the piece itself in *piece.
+ */
+static BB least_valuable(BB const attackers, int const side, int *const piece) {
+  int const min = side == WHITE ? P : p;
+
+  for (int pc = min; pc <= min + 5; pc++) {
+    BB const subset = attackers & pos_pieces[pc];
+    if (subset) {
+      *piece = pc;
+      return subset & -subset;
+    }
+  }
+  return 0ULL;
+}
+
+/*
+ * @returns Material balance of the exchange for the side making the move
+ */
+int see(MOVE const move) {
+  int gain[32];
+  int depth = 0;
+  int const target = GET_MOVE_TARGET(move);
+  int piece = GET_MOVE_PIECE(move);
+  int side = pos_side;
+
+  if (GET_MOVE_CASTLING(move))
+    return 0;
+
+  BB occupancy = pos_occupancies[BOTH] ^ (1ULL << GET_MOVE_SOURCE(move));
+  if (GET_MOVE_EP(move))
+    occupancy ^= 1ULL << (side == WHITE ? target + 8 : target - 8);
+
+  BB const diagonal = pos_pieces[B] | pos_pieces[b] | pos_pieces[Q] | pos_pieces[q];
+  BB const orthogonal = pos_pieces[R] | pos_pieces[r] | pos_pieces[Q] | pos_pieces[q];
+  BB attackers = attackers_to(target, occupancy) & occupancy;
+
+  gain[0] = captured_value(move);
+  int on_square = GET_MOVE_PROMOTION(move) ? see_values[GET_MOVE_PROMOTION(move)] : see_values[piece];
+
+  while (1) {
+    side = !side;
+    BB const from = least_valuable(attackers & pos_occupancies[side], side, &piece);
+    if (!from)
+      break;
+
+    // the king may only recapture if the square is no longer defended
+    if ((piece == K || piece == k) && (attackers & pos_occupancies[!side] & ~from))
+      break;
+
+    depth++;
+    gain[depth] = on_square - gain[depth - 1]; // balance for side if the exchange stopped here
+
+    on_square = see_values[piece];
+    occupancy ^= from;
+    attackers |= (get_bishop_attacks(target, occupancy) & diagonal) |
+                 (get_rook_attacks(target, occupancy) & orthogonal);
+    attackers &= occupancy;
+  }
+
+  // going backwards, each side either stops or recaptures, whichever is better
+  while (depth) {
+    depth--;
+    if (-gain[depth + 1] < gain[depth])
+      gain[depth] = -gain[depth + 1];
+  }
+  return gain[0];
+}
+
+/*
+ * @returns True if the exchange started by the move gains at least
+ *          threshold. Cheaper than see(), as it stops as soon as
+ *          the outcome relative to threshold is known.
+ */
+bool see_ge(MOVE const move, int const threshold) {
+  int const target = GET_MOVE_TARGET(move);
+  int side = pos_side;
+  int piece;
+
+  if (GET_MOVE_CASTLING(move))
+    return threshold <= 0;
+
+  int swap = captured_value(move) - threshold;
+  if (swap < 0)
+    return false;
+
+  swap = (GET_MOVE_PROMOTION(move) ? see_values[GET_MOVE_PROMOTION(move)] : see_values[GET_MOVE_PIECE(move)]) - swap;
+  if (swap <= 0)
+    return true;
+
+  BB occupancy = pos_occupancies[BOTH] ^ (1ULL << GET_MOVE_SOURCE(move));
+  if (GET_MOVE_EP(move))
+    occupancy ^= 1ULL << (side == WHITE ? target + 8 : target - 8);
+
+  BB const diagonal = pos_pieces[B] | pos_pieces[b] | pos_pieces[Q] | pos_pieces[q];
+  BB const orthogonal = pos_pieces[R] | pos_pieces[r] | pos_pieces[Q] | pos_pieces[q];
+  BB attackers = attackers_to(target, occupancy);
+  bool result = true;
+
+  while (1) {
+    side = !side;
+    attackers &= occupancy;
+    BB const from = least_valuable(attackers & pos_occupancies[side], side, &piece);
+    if (!from)
+      break;
+
+    if (piece == K || piece == k) // a king recapture stands only if nothing can take back
+      return (attackers & pos_occupancies[!side]) ? result : !result;
+
+    result = !result;
+    swap = see_values[piece] - swap;
+    if (swap < result)
+      break;
+
+    occupancy ^= from;
+    attackers |= (get_bishop_attacks(target, occupancy) & diagonal) |
+                 (get_rook_attacks(target, occupancy) & orthogonal);
+  }
+
+  return result;
+}
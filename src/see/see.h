@@ -0,0 +1,9 @@
+#ifndef SPARK_SEE_H
+#define SPARK_SEE_H
+#include <stdbool.h>
+#include "../Types.h"
+
+int see(MOVE move);
+bool see_ge(MOVE move, int threshold);
+
+#endif
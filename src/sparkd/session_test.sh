@@ -0,0 +1,52 @@
+#!/bin/sh
+# Runs request sessions through bin/sparkd and compares the replies.
+
+sparkd=${1:-bin/sparkd}
+status=0
+
+# session <name> <requests> <expected replies>
+session() {
+  replies=$(printf '%s\n' "$2" | "$sparkd")
+  if [ "$replies" = "$3" ]; then
+    echo "$1: success :)"
+  else
+    printf '%s: failed :(\nexpected:\n%s\ngot:\n%s\n' "$1" "$3" "$replies"
+    status=1
+  fi
+}
+
+echo "--> Running sparkd sessions"
+
+session "undo after a rejected position" \
+"position startpos moves e2e4
+position fen garbage
+undo
+fen" \
+"ok
+error invalid position
+ok
+fen rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+
+session "undo after rejected moves" \
+"position startpos moves e2e4 e7e5
+position startpos moves d2d4 e2e5
+fen
+undo
+undo
+undo" \
+"ok
+error illegal move e2e5
+fen rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR w KQkq e6 0 2
+ok
+ok
+error nothing to undo"
+
+session "perft depths" \
+"perft 3
+perft 0
+perft 65" \
+"perft 8902
+error depth must be 1 to 64
+error depth must be 1 to 64"
+
+exit $status
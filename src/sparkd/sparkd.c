@@ -0,0 +1,307 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "../../inc/spark.h"
+
+/*
+ * sparkd: move generation server. The attack tables are built once,
+ * then requests are answered over stdin/stdout, or over a Unix domain
+ * socket with one forked process (and board) per client.
+ *
+ * Usage: sparkd [--socket <path>]
+ *
+ * Requests are single lines, every request gets exactly one reply
+ * line, in order, so clients may pipeline any number of requests.
+ * Replies are collected and written in one go once no further
+ * complete request is buffered.
+ *
+ *   position startpos [moves <m>...]      -> ok
+ *   position fen <fen> [moves <m>...]     -> ok
+ *   play <m>...                           -> ok
+ *   undo                                  -> ok
+ *   list                                  -> moves <m>...
+ *   legal <m>                             -> legal true|false
+ *   count                                 -> count <n>
+ *   perft <depth>                         -> perft <nodes>
+ *   fen                                   -> fen <fen>
+ *   ping                                  -> pong
+ *   quit                                  (no reply, ends the session)
+ *
+ * Moves are in UCI notation. A failing request replies
+ * "error <reason>" and leaves the position unchanged.
+ */
+
+#define START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+#define BUFFER_SIZE (1 << 16)
+#define MAX_PLIES 900 // moves kept for undo, within the limits of the board's stacks
+
+static char input[BUFFER_SIZE];
+static size_t input_length;
+static char output[BUFFER_SIZE];
+static size_t output_length;
+static int output_fd;
+static int plies; // moves played since the last position request
+static BoardSnapshot previous; // restored by a failing position request
+
+static bool flush_output(void);
+static void reply(char const *format, ...);
+static bool play_moves(char *moves);
+static void handle_position(char *args);
+static bool handle_request(char *line);
+static void serve(int in_fd, int out_fd);
+static int serve_socket(char const *path);
+
+static bool flush_output(void) {
+  size_t written = 0;
+
+  while (written < output_length) {
+    ssize_t const n = write(output_fd, output + written, output_length - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    written += n;
+  }
+  output_length = 0;
+  return true;
+}
+
+static void reply(char const *const format, ...) {
+  va_list args;
+
+  for (int attempt = 0; attempt < 2; attempt++) {
+    va_start(args, format);
+    int const n = vsnprintf(output + output_length, sizeof(output) - output_length, format, args);
+    va_end(args);
+
+    if (n >= 0 && output_length + n + 1 < sizeof(output)) {
+      output_length += n;
+      output[output_length++] = '\n';
+      return;
+    }
+    flush_output(); // make room and try again
+  }
+}
+
+/*
+ * Plays the space separated UCI moves. If one of them is illegal,
+ * the moves played before it are taken back.
+ */
+static bool play_moves(char *const moves) {
+  int played = 0;
+
+  for (char *token = strtok(moves, " "); token; token = strtok(NULL, " ")) {
+    size_t const length = strlen(token);
+    MOVE const move = length == 4 || length == 5 ? parse_uci_move(token) : 0;
+
+    if (!move || plies >= MAX_PLIES) {
+      reply(move ? "error too many moves" : "error illegal move %s", token);
+      for (; played > 0; played--, plies--)
+        takeback();
+      return false;
+    }
+    make_move(move);
+    played++;
+    plies++;
+  }
+  return true;
+}
+
+/*
+ * On failure the previous board, including the moves that can be
+ * undone, is restored from a snapshot.
+ */
+static void handle_position(char *const args) {
+  char *moves = strstr(args, " moves");
+  int const previous_plies = plies;
+  bool loaded;
+
+  board_snapshot(&previous);
+  if (moves) {
+    *moves = '\0';
+    moves += strlen(" moves");
+  }
+
+  if (!strcmp(args, "startpos"))
+    loaded = load_fen(START_FEN);
+  else if (!strncmp(args, "fen ", 4))
+    loaded = load_fen(args + 4);
+  else
+    loaded = false;
+
+  if (!loaded) {
+    board_restore(&previous);
+    plies = previous_plies;
+    reply("error invalid position");
+    return;
+  }
+
+  plies = 0;
+  if (moves && !play_moves(moves)) {
+    board_restore(&previous); // the error has been sent by play_moves()
+    plies = previous_plies;
+    return;
+  }
+  reply("ok");
+}
+
+/*
+ * @returns false when the session ends
+ */
+static bool handle_request(char *const line) {
+  char *args = line + strcspn(line, " ");
+
+  if (*args)
+    *args++ = '\0';
+  args += strspn(args, " ");
+
+  if (!strcmp(line, "position")) {
+    handle_position(args);
+  } else if (!strcmp(line, "play")) {
+    if (play_moves(args))
+      reply("ok");
+  } else if (!strcmp(line, "undo")) {
+    if (plies > 0) {
+      takeback();
+      plies--;
+      reply("ok");
+    } else {
+      reply("error nothing to undo");
+    }
+  } else if (!strcmp(line, "list")) {
+    MoveList move_list;
+    char moves[256 * 6];
+    generate_moves_into(&move_list);
+    move_list_to_uci(&move_list, moves, sizeof(moves));
+    reply("moves%s%s", move_list.current_index ? " " : "", moves);
+  } else if (!strcmp(line, "legal")) {
+    size_t const length = strlen(args);
+    reply("legal %s", (length == 4 || length == 5) && parse_uci_move(args) ? "true" : "false");
+  } else if (!strcmp(line, "count")) {
+    reply("count %d", count_legal_moves());
+  } else if (!strcmp(line, "perft")) {
+    int const depth = atoi(args);
+    if (depth < 1 || depth > MAX_PERFT_DEPTH)
+      reply("error depth must be 1 to %d", MAX_PERFT_DEPTH);
+    else
+      reply("perft %lu", perft(depth));
+  } else if (!strcmp(line, "fen")) {
+    char fen[100];
+    board_to_fen(fen, sizeof(fen));
+    reply("fen %s", fen);
+  } else if (!strcmp(line, "ping")) {
+    reply("pong");
+  } else if (!strcmp(line, "quit")) {
+    return false;
+  } else if (*line) {
+    reply("error unknown request %s", line);
+  }
+  return true;
+}
+
+/*
+ * Answers the requests of one session. Every complete line in the
+ * input buffer is handled before the replies are written, which
+ * batches the replies of pipelined requests.
+ */
+static void serve(int const in_fd, int const out_fd) {
+  bool running = true;
+
+  output_fd = out_fd;
+  input_length = 0;
+  output_length = 0;
+  plies = 0;
+  load_fen(START_FEN);
+
+  while (running) {
+    ssize_t const n = read(in_fd, input + input_length, sizeof(input) - 1 - input_length);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    input_length += n;
+
+    char *line = input;
+    char *end;
+    while (running && (end = memchr(line, '\n', input + input_length - line))) {
+      *end = '\0';
+      if (end > line && end[-1] == '\r')
+        end[-1] = '\0';
+      running = handle_request(line);
+      line = end + 1;
+    }
+
+    input_length -= line - input;
+    memmove(input, line, input_length);
+    if (input_length == sizeof(input) - 1) { // a line that can never be complete
+      reply("error request too long");
+      input_length = 0;
+    }
+    if (!flush_output())
+      break;
+  }
+  flush_output();
+}
+
+static int serve_socket(char const *const path) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path too long\n");
+    return EXIT_FAILURE;
+  }
+  strcpy(address.sun_path, path);
+
+  int const listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(path);
+  if (listener < 0 || bind(listener, (struct sockaddr *) &address, sizeof(address)) < 0 ||
+      listen(listener, 64) < 0) {
+    perror("sparkd");
+    return EXIT_FAILURE;
+  }
+
+  signal(SIGCHLD, SIG_IGN); // clients are reaped automatically
+
+  while (1) {
+    int const client = accept(listener, NULL, NULL);
+    if (client < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("sparkd");
+      return EXIT_FAILURE;
+    }
+
+    pid_t const pid = fork();
+    if (pid == 0) {
+      close(listener);
+      serve(client, client);
+      close(client);
+      _exit(EXIT_SUCCESS);
+    }
+    if (pid < 0)
+      perror("sparkd");
+    close(client);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  init_attack_tables();
+  signal(SIGPIPE, SIG_IGN); // a closed connection shows up as a write error
+
+  if (argc == 3 && !strcmp(argv[1], "--socket"))
+    return serve_socket(argv[2]);
+  if (argc != 1) {
+    fprintf(stderr, "Usage: %s [--socket <path>]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  serve(STDIN_FILENO, STDOUT_FILENO);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,287 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../inc/spark.h"
+
+/*
+ * spark-uci: UCI front end. The main thread reads and answers the
+ * input, every "go" runs on a search thread that gets a copy of the
+ * position, so "stop", "isready" and the like are answered while
+ * searching. Supported:
+ *
+ *   uci, isready, ucinewgame, quit
+ *   setoption name Hash value <MB>
+ *   setoption name Threads value <n>
+ *   setoption name EvalFile value <path>   (NNUE weights, empty for none)
+ *   position startpos|fen <fen> [moves <m>...]
+ *   go [depth <d>] [nodes <n>] [movetime <ms>] [infinite]
+ *      [wtime <ms>] [btime <ms>] [winc <ms>] [binc <ms>] [movestogo <n>]
+ *   go perft <depth>
+ *   stop
+ */
+
+#define START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+#define MAX_PLIES 900 // moves of a position command, within the limits of the board's stacks
+#define DEFAULT_MOVES_TO_GO 30
+#define MOVE_OVERHEAD_MS 50
+#define EVAL_FILE_OPTION "name EvalFile value"
+
+typedef struct GoCommand {
+  SearchLimits limits;
+  int perft_depth; // 0 for a search
+  bool infinite;
+} GoCommand;
+
+static BoardSnapshot position; // handed to the search thread
+static GoCommand go_command;
+static pthread_t search_thread;
+static bool searching; // a search thread has been started and not joined
+
+// an infinite search waits for "stop" before it reports its move
+static pthread_mutex_t stop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stop_signal = PTHREAD_COND_INITIALIZER;
+static atomic_bool stop_requested;
+static atomic_bool perft_stopped;
+
+static void report(SearchResult const *result);
+static void run_perft(int depth);
+static void *search_main(void *arg);
+static void stop_search(void);
+static void handle_position(char *args);
+static void handle_go(char *args);
+static void handle_setoption(char *args);
+
+static void report(SearchResult const *const result) {
+  char line[SEARCH_MAX_PLY * 6 + 128];
+  int length;
+
+  if (stop_requested) // "stop" came before search() had started
+    search_stop();
+
+  if (result->score > SEARCH_MATE - SEARCH_MAX_PLY)
+    length = snprintf(line, sizeof(line), "info depth %d score mate %d", result->depth,
+                      (SEARCH_MATE - result->score + 1) / 2);
+  else if (result->score < -SEARCH_MATE + SEARCH_MAX_PLY)
+    length = snprintf(line, sizeof(line), "info depth %d score mate %d", result->depth,
+                      -(SEARCH_MATE + result->score) / 2);
+  else
+    length = snprintf(line, sizeof(line), "info depth %d score cp %d", result->depth, result->score);
+
+  length += snprintf(line + length, sizeof(line) - length, " nodes %lu nps %lu time %ld pv", result->nodes,
+                     result->time_ms ? result->nodes * 1000 / result->time_ms : result->nodes, result->time_ms);
+  for (int i = 0; i < result->pv_length; i++) {
+    line[length++] = ' ';
+    length += move_to_uci(result->pv[i], line + length);
+  }
+  printf("%s\n", line);
+  fflush(stdout);
+}
+
+/*
+ * Prints the node count of every root move and the total, like
+ * other engines do for "go perft".
+ */
+static void run_perft(int const depth) {
+  MoveList roots;
+  BB total = 0;
+
+  generate_moves_into(&roots);
+  for (int i = 0; i < roots.current_index && !perft_stopped; i++) {
+    make_move(roots.moves[i]);
+    BB const nodes = perft(depth - 1);
+    takeback();
+    if (perft_stopped)
+      break;
+    printf("%s: %lu\n", get_move_UCI(roots.moves[i]), nodes);
+    total += nodes;
+  }
+  printf("\nNodes searched: %lu\n\n", total);
+  fflush(stdout);
+}
+
+static void *search_main(void *const arg) {
+  GoCommand const *const go = arg;
+  SearchResult result;
+  char move[6] = "0000";
+
+  board_restore(&position);
+  if (go->perft_depth) {
+    run_perft(go->perft_depth);
+    return NULL;
+  }
+
+  if (search(&go->limits, &result))
+    move_to_uci(result.best_move, move);
+
+  if (go->infinite) {
+    pthread_mutex_lock(&stop_lock);
+    while (!stop_requested)
+      pthread_cond_wait(&stop_signal, &stop_lock);
+    pthread_mutex_unlock(&stop_lock);
+  }
+  printf("bestmove %s\n", move);
+  fflush(stdout);
+  return NULL;
+}
+
+/*
+ * Stops a running search or perft and waits for its result.
+ */
+static void stop_search(void) {
+  if (!searching)
+    return;
+
+  pthread_mutex_lock(&stop_lock);
+  stop_requested = true;
+  pthread_cond_signal(&stop_signal);
+  pthread_mutex_unlock(&stop_lock);
+  search_stop();
+  perft_stopped = true; // between root moves
+  perft_stop(); // within one
+
+  pthread_join(search_thread, NULL);
+  searching = false;
+}
+
+static void handle_position(char *const args) {
+  char *moves = strstr(args, " moves");
+
+  if (moves) {
+    *moves = '\0';
+    moves += strlen(" moves");
+  }
+
+  // startpos, or a FEN that can't be used: UCI has no way to report it
+  if (strncmp(args, "fen ", 4) || !load_fen(args + 4))
+    load_fen(START_FEN);
+
+  int plies = 0;
+  for (char *token = moves ? strtok(moves, " ") : NULL; token; token = strtok(NULL, " ")) {
+    MOVE const move = plies < MAX_PLIES ? parse_uci_move(token) : 0;
+    if (!move)
+      break;
+    make_move(move);
+    plies++;
+  }
+}
+
+/*
+ * Parses the limits and starts the search thread.
+ */
+static void handle_go(char *const args) {
+  GoCommand go = {.limits.report = report};
+  int64_t times[2] = {0}, increments[2] = {0};
+  int moves_to_go = DEFAULT_MOVES_TO_GO;
+
+  for (char *token = strtok(args, " "); token; token = strtok(NULL, " ")) {
+    char *const value = strcmp(token, "infinite") ? strtok(NULL, " ") : NULL;
+    long long const number = value ? atoll(value) : 0;
+
+    if (!strcmp(token, "infinite"))
+      go.infinite = true;
+    else if (!strcmp(token, "depth"))
+      go.limits.depth = number;
+    else if (!strcmp(token, "nodes"))
+      go.limits.nodes = number;
+    else if (!strcmp(token, "movetime"))
+      go.limits.time_ms = number;
+    else if (!strcmp(token, "wtime"))
+      times[WHITE] = number;
+    else if (!strcmp(token, "btime"))
+      times[BLACK] = number;
+    else if (!strcmp(token, "winc"))
+      increments[WHITE] = number;
+    else if (!strcmp(token, "binc"))
+      increments[BLACK] = number;
+    else if (!strcmp(token, "movestogo") && number > 0)
+      moves_to_go = number;
+    else if (!strcmp(token, "perft"))
+      go.perft_depth = number < 1 ? 1 : number > MAX_PERFT_DEPTH ? MAX_PERFT_DEPTH : number;
+  }
+
+  // a share of the remaining time, never all of it
+  if (times[pos_side] > 0 && !go.limits.time_ms) {
+    int64_t const left = times[pos_side] - MOVE_OVERHEAD_MS;
+    int64_t const share = times[pos_side] / moves_to_go + increments[pos_side] / 2;
+    go.limits.time_ms = share < left ? share : left;
+    if (go.limits.time_ms < 1)
+      go.limits.time_ms = 1;
+  }
+
+  go_command = go;
+  board_snapshot(&position);
+  stop_requested = false;
+  perft_stopped = false;
+  if (pthread_create(&search_thread, NULL, search_main, &go_command) == 0)
+    searching = true;
+  else
+    printf("bestmove 0000\n");
+}
+
+static void handle_setoption(char *const args) {
+  char name[32];
+  int value;
+
+  if (!strncmp(args, EVAL_FILE_OPTION, strlen(EVAL_FILE_OPTION))) {
+    char const *const path = args + strlen(EVAL_FILE_OPTION) + strspn(args + strlen(EVAL_FILE_OPTION), " ");
+    // no file or one that can't be loaded: back to the built-in evaluation
+    nnue_enable(*path && strcmp(path, "<empty>") && nnue_load(path) == 0);
+    return;
+  }
+  if (sscanf(args, "name %31s value %d", name, &value) != 2)
+    return;
+  if (!strcmp(name, "Hash"))
+    search_set_hash(value);
+  else if (!strcmp(name, "Threads"))
+    search_set_threads(value);
+}
+
+int main(void) {
+  char line[16384];
+
+  init_attack_tables();
+  load_fen(START_FEN);
+
+  while (fgets(line, sizeof(line), stdin)) {
+    line[strcspn(line, "\r\n")] = '\0';
+
+    char *args = line + strcspn(line, " ");
+    if (*args)
+      *args++ = '\0';
+    args += strspn(args, " ");
+
+    if (!strcmp(line, "uci")) {
+      printf("id name Spark\n");
+      printf("id author Stefanos Koutsouflakis\n");
+      printf("option name Hash type spin default 16 min 1 max 65536\n");
+      printf("option name Threads type spin default 1 min 1 max 256\n");
+      printf("option name EvalFile type string default <empty>\n");
+      printf("uciok\n");
+    } else if (!strcmp(line, "isready")) {
+      printf("readyok\n");
+    } else if (!strcmp(line, "ucinewgame")) {
+      stop_search();
+      search_clear();
+    } else if (!strcmp(line, "setoption")) {
+      stop_search();
+      handle_setoption(args);
+    } else if (!strcmp(line, "position")) {
+      stop_search();
+      handle_position(args);
+    } else if (!strcmp(line, "go")) {
+      stop_search();
+      handle_go(args);
+    } else if (!strcmp(line, "stop")) {
+      stop_search();
+    } else if (!strcmp(line, "quit")) {
+      break;
+    }
+    fflush(stdout);
+  }
+
+  stop_search();
+  return EXIT_SUCCESS;
+}
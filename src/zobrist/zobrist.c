@@ -0,0 +1,57 @@
+#include "../board/board.h"
+#include "zobrist.h"
+
+/*
+ * Zobrist keys. The position key (pos_key) is the XOR of the keys
+ * of every piece on its square, the castling rights, the ep square
+ * and, with black to move, side_key. make_move() updates it
+ * incrementally, compute_key() builds it from scratch.
+ */
+
+BB piece_keys[12][64];
+BB castling_keys[16];
+BB ep_keys[65];
+BB side_key;
+
+// splitmix64, so that keys are the same on every run
+static BB next_key(BB *const state) {
+  BB z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+void init_zobrist(void) {
+  BB state = 0x5350415243ULL; // "SPARC"
+
+  for (int piece = P; piece <= k; piece++)
+    for (int square = 0; square < 64; square++)
+      piece_keys[piece][square] = next_key(&state);
+
+  for (int rights = 0; rights < 16; rights++)
+    castling_keys[rights] = rights ? next_key(&state) : 0;
+
+  for (int square = 0; square < 64; square++)
+    ep_keys[square] = next_key(&state);
+  ep_keys[none] = 0;
+
+  side_key = next_key(&state);
+}
+
+BB compute_key(void) {
+  BB key = 0;
+
+  for (int piece = P; piece <= k; piece++) {
+    BB bitboard = pos_pieces[piece];
+    while (bitboard) {
+      int const square = FIRST_SET_BIT(bitboard);
+      key ^= piece_keys[piece][square];
+      CLEAR_BIT(bitboard, square);
+    }
+  }
+  key ^= castling_keys[pos_castling];
+  key ^= ep_keys[pos_ep];
+  if (pos_side == BLACK)
+    key ^= side_key;
+  return key;
+}
@@ -0,0 +1,13 @@
+#ifndef SPARK_ZOBRIST_H
+#define SPARK_ZOBRIST_H
+#include "../Types.h"
+
+extern BB piece_keys[12][64];
+extern BB castling_keys[16];
+extern BB ep_keys[65]; // ep_keys[none] is 0
+extern BB side_key;
+
+void init_zobrist(void);
+BB compute_key(void);
+
+#endif